@@ -0,0 +1,376 @@
+/*
+ *  InferenceServer.cpp
+ *
+ *  Inference server: serves predictions from a trained model over a Unix
+ *      domain socket, coalescing concurrent requests into micro-batches
+ *      that are scored by a pool of worker threads.
+ *
+ *  Batching policy:
+ *      (1) a worker starts scoring once the queued requests hold at least
+ *          the max batch size in rows, or once the oldest queued request
+ *          has waited for the batch latency budget
+ *      (2) a batch takes whole requests in arrival order, up to the max
+ *          batch size (a single larger request is scored on its own)
+ *      (3) workers only use the model's const predict(), so they score
+ *          batches in parallel without locking the model
+ */
+
+
+#include "InferenceServer.h"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+
+namespace trees
+{
+    //max # of rows accepted in a single request
+    static const uint32_t MAX_REQUEST_ROWS = 1 << 20;
+
+    InferenceServer::Histogram::Histogram()
+    : buckets(65, 0)
+    {
+        count = 0;
+        sum = 0;
+        max = 0;
+    }
+
+    //adds value v to the histogram
+    void InferenceServer::Histogram::record(uint64_t v)
+    {
+        int b = 0;
+        while (b < 64 && (v >> b) != 0) {
+            b++;
+        }
+        buckets[b]++;
+        count++;
+        sum += v;
+        if (v > max) max = v;
+    }
+
+    //returns upper bound of the bucket holding quantile q
+    uint64_t InferenceServer::Histogram::valueAt(double q) const
+    {
+        uint64_t target = (uint64_t)ceil(q*count);
+        uint64_t seen = 0;
+        for (unsigned int b=0; b<buckets.size(); b++) {
+            seen += buckets[b];
+            if (seen >= target && seen > 0) {
+                return (b == 0) ? 0 : std::min(max, (((uint64_t)1) << b) - 1);
+            }
+        }
+        return max;
+    }
+
+    //returns one line summary followed by the non-empty buckets
+    string InferenceServer::Histogram::summary(const string& name, const string& unit) const
+    {
+        ostringstream out;
+        out << name << " (" << unit << "): count " << count;
+        if (count > 0) {
+            out << " mean " << ((double)sum)/count << " p50 <=" << valueAt(0.5) << " p90 <=" << valueAt(0.9)
+                << " p99 <=" << valueAt(0.99) << " max " << max;
+        }
+        out << endl;
+        for (unsigned int b=0; b<buckets.size(); b++) {
+            if (buckets[b] > 0) {
+                uint64_t lo = (b == 0) ? 0 : (((uint64_t)1) << (b-1));
+                uint64_t hi = (b == 0) ? 0 : (((uint64_t)1) << b) - 1;
+                out << "\t[" << lo << ", " << hi << "]\t" << buckets[b] << endl;
+            }
+        }
+        return out.str();
+    }
+
+    //set model, # of worker threads, max batch size (rows), batch wait (us), cpu pinning
+    InferenceServer::InferenceServer(const DecisionTree& model, int nWorkers, int maxBatchRows, int batchWaitUs, bool pin)
+    : _model(model), _batchWait(batchWaitUs)
+    {
+        _nWorkers = (nWorkers < 1) ? 1 : nWorkers;
+        _maxBatchRows = (maxBatchRows < 1) ? 1 : maxBatchRows;
+        _pinWorkers = pin;
+        _listenFd = -1;
+        _stopping = false;
+        _queuedRows = 0;
+    }
+
+    InferenceServer::~InferenceServer()
+    {
+        stop();
+    }
+
+    //asks server to shut down (safe to call from a signal handler)
+    void InferenceServer::stop()
+    {
+        _stopping = true;
+    }
+
+    //listens on socket path and serves requests until stop() is called
+    bool InferenceServer::serve(const string& socketPath)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path)) {
+            cerr << "Error: socket path too long: " << socketPath << endl;
+            return false;
+        }
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        //make listening socket (replacing any stale socket file)
+        _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listenFd < 0) {
+            cerr << "Error: can't create socket: " << strerror(errno) << endl;
+            return false;
+        }
+        unlink(socketPath.c_str());
+        if (bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listenFd, 128) < 0) {
+            cerr << "Error: can't listen on " << socketPath << ": " << strerror(errno) << endl;
+            close(_listenFd);
+            _listenFd = -1;
+            return false;
+        }
+        _socketPath = socketPath;
+
+        //start scoring threads
+        for (int i=0; i<_nWorkers; i++) {
+            _workers.push_back(thread(&InferenceServer::runWorker, this, i));
+        }
+
+        //accept connections, checking for shutdown in between; each connection
+        //  gets its own detached thread, which removes its fd when it's done
+        while (!_stopping) {
+
+            pollfd p;
+            p.fd = _listenFd;
+            p.events = POLLIN;
+            if (poll(&p, 1, 100) <= 0) continue;
+
+            int fd = accept(_listenFd, NULL, NULL);
+            if (fd < 0) continue;
+            {
+                lock_guard<mutex> lock(_connMutex);
+                _connections.insert(fd);
+            }
+            thread(&InferenceServer::handleConnection, this, fd).detach();
+        }
+
+        //stop accepting, let workers drain the queue
+        close(_listenFd);
+        _listenFd = -1;
+        unlink(_socketPath.c_str());
+        {
+            lock_guard<mutex> lock(_queueMutex);
+            _queueCond.notify_all();
+        }
+
+        //wake clients blocked mid-request (reads fail), wait for all connections to close
+        {
+            unique_lock<mutex> lock(_connMutex);
+            for (set<int>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+                shutdown(*it, SHUT_RDWR);
+            }
+            while (!_connections.empty()) {
+                _connCond.wait(lock);
+            }
+        }
+        for (unsigned int i=0; i<_workers.size(); i++) {
+            _workers[i].join();
+        }
+        _workers.clear();
+        return true;
+    }
+
+    //scoring thread: waits for a batch to fill (or its deadline), scores it
+    void InferenceServer::runWorker(int index)
+    {
+#ifdef __linux__
+        if (_pinWorkers) {
+            int nCpus = thread::hardware_concurrency();
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(index % (nCpus > 0 ? nCpus : 1), &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#endif
+
+        DecisionTree::Matrix batch;
+        vector<int> predictions;
+        vector<Request*> requests;
+
+        unique_lock<mutex> lock(_queueMutex);
+        while (true) {
+
+            while (!_stopping && _queue.empty()) {
+                _queueCond.wait_for(lock, chrono::milliseconds(100));
+            }
+            if (_queue.empty()) break;
+
+            //wait until batch is full or the oldest request's budget runs out
+            while (!_stopping && !_queue.empty() && _queuedRows < _maxBatchRows) {
+                Clock::time_point deadline = _queue.front()->enqueued + _batchWait;
+                if (_queueCond.wait_until(lock, deadline) == cv_status::timeout) break;
+            }
+            if (_queue.empty()) continue;
+
+            //take whole requests in arrival order, up to max batch size
+            int nRows = 0;
+            while (!_queue.empty() && (requests.empty() || nRows + (int)_queue.front()->rows.size() <= _maxBatchRows)) {
+                requests.push_back(_queue.front());
+                nRows += _queue.front()->rows.size();
+                _queue.pop_front();
+            }
+            _queuedRows -= nRows;
+            if (!_queue.empty()) _queueCond.notify_all();
+            lock.unlock();
+
+            //gather rows into one matrix (rows are moved, not copied)
+            Clock::time_point start = Clock::now();
+            for (unsigned int i=0; i<requests.size(); i++) {
+                for (unsigned int j=0; j<requests[i]->rows.size(); j++) {
+                    batch.push_back(vector<int>());
+                    batch.back().swap(requests[i]->rows[j]);
+                }
+            }
+
+            _model.predict(batch, predictions);
+
+            //hand predictions back to each request
+            Clock::time_point end = Clock::now();
+            int offset = 0;
+            {
+                lock_guard<mutex> statsLock(_statsMutex);
+                _batchRows.record(nRows);
+                _batchRequests.record(requests.size());
+                for (unsigned int i=0; i<requests.size(); i++) {
+                    _queueTime.record(chrono::duration_cast<chrono::microseconds>(start - requests[i]->enqueued).count());
+                    _latency.record(chrono::duration_cast<chrono::microseconds>(end - requests[i]->enqueued).count());
+                }
+            }
+            for (unsigned int i=0; i<requests.size(); i++) {
+                int n = requests[i]->rows.size();
+                requests[i]->predictions.assign(predictions.begin() + offset, predictions.begin() + offset + n);
+                offset += n;
+                requests[i]->done.set_value();
+            }
+
+            batch.clear();
+            requests.clear();
+            lock.lock();
+        }
+    }
+
+    //reads requests from one client until it disconnects or server stops
+    void InferenceServer::handleConnection(int fd)
+    {
+        int nFeatures = _model.getNumFeatures();
+
+        while (!_stopping) {
+
+            //wait for next request header, checking for shutdown in between
+            pollfd p;
+            p.fd = fd;
+            p.events = POLLIN;
+            if (poll(&p, 1, 100) <= 0) continue;
+
+            uint32_t header[3];
+            if (!readFully(fd, header, sizeof(header))) break;
+
+            //stats request: reply with text summary
+            if (header[0] == OP_STATS) {
+                string stats = getStats();
+                if (!sendResponse(fd, STATUS_OK, stats.size(), stats.data(), stats.size())) break;
+                continue;
+            }
+
+            //reject anything we can't score (and drop connection, stream can't be trusted)
+            uint32_t nRows = header[1];
+            if (header[0] != OP_PREDICT || header[2] != (uint32_t)nFeatures || nRows > MAX_REQUEST_ROWS) {
+                sendResponse(fd, STATUS_BAD_REQUEST, 0, NULL, 0);
+                break;
+            }
+
+            Request req;
+            req.rows.resize(nRows, vector<int>(nFeatures));
+            bool ok = true;
+            for (uint32_t i=0; i<nRows && ok; i++) {
+                ok = readFully(fd, &req.rows[i][0], nFeatures*sizeof(int));
+            }
+            if (!ok) break;
+
+            //queue request and wait for a worker to score it
+            if (nRows > 0) {
+                future<void> done = req.done.get_future();
+                {
+                    //workers may already have drained the queue and exited
+                    lock_guard<mutex> lock(_queueMutex);
+                    if (_stopping) break;
+                    req.enqueued = Clock::now();
+                    _queue.push_back(&req);
+                    _queuedRows += nRows;
+                    _queueCond.notify_all();
+                }
+                done.wait();
+            }
+
+            if (!sendResponse(fd, STATUS_OK, nRows, req.predictions.data(), nRows*sizeof(int))) break;
+        }
+
+        //close under lock so serve() never shuts down a reused fd
+        lock_guard<mutex> lock(_connMutex);
+        _connections.erase(fd);
+        close(fd);
+        _connCond.notify_all();
+    }
+
+    //returns text summary of queueing, batch size and latency histograms
+    string InferenceServer::getStats()
+    {
+        lock_guard<mutex> lock(_statsMutex);
+        return _queueTime.summary("queue time", "us") + _batchRows.summary("batch size", "rows")
+            + _batchRequests.summary("batch size", "requests") + _latency.summary("latency", "us");
+    }
+
+    //reads exactly n bytes, false if connection closed or failed
+    bool InferenceServer::readFully(int fd, void* buf, size_t n)
+    {
+        char* p = (char*)buf;
+        while (n > 0) {
+            ssize_t r = read(fd, p, n);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            n -= r;
+        }
+        return true;
+    }
+
+    //writes exactly n bytes, false if connection closed or failed
+    bool InferenceServer::writeFully(int fd, const void* buf, size_t n)
+    {
+        const char* p = (const char*)buf;
+        while (n > 0) {
+            ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            p += w;
+            n -= w;
+        }
+        return true;
+    }
+
+    //writes response header (status, length) followed by payload
+    bool InferenceServer::sendResponse(int fd, uint32_t status, uint32_t length, const void* payload, size_t n)
+    {
+        uint32_t header[2] = { status, length };
+        return writeFully(fd, header, sizeof(header)) && writeFully(fd, payload, n);
+    }
+}
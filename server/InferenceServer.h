@@ -0,0 +1,118 @@
+/*
+ *  InferenceServer.h
+ *
+ *  Inference server: serves predictions from a trained model over a Unix
+ *      domain socket, coalescing concurrent requests into micro-batches
+ *      that are scored by a pool of worker threads.
+ *
+ *  Protocol (all fields 32-bit, host byte order):
+ *      request:  op, # rows, # columns, then rows*columns feature values
+ *                (row-major); op 1 = predict, op 2 = stats (0 rows/columns)
+ *      response: status (0 = ok, 1 = bad request), length, then either
+ *                length predicted labels (predict) or length bytes of text
+ *                (stats)
+ *  A connection may send any number of requests, one at a time.
+ */
+
+#ifndef InferenceServer_H
+#define InferenceServer_H
+
+#include <stdint.h>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "DecisionTree.h"
+
+
+namespace trees {
+
+    class InferenceServer
+    {
+
+    public:
+
+        //request ops and response status codes
+        enum { OP_PREDICT = 1, OP_STATS = 2 };
+        enum { STATUS_OK = 0, STATUS_BAD_REQUEST = 1 };
+
+        //constructor/destructor
+        InferenceServer(const DecisionTree&, int=4, int=256, int=500, bool=false);
+        ~InferenceServer();
+
+        //functions
+        bool serve(const std::string&);
+        void stop();
+        std::string getStats();
+
+
+    private:
+
+        typedef std::chrono::steady_clock Clock;
+
+        //log2-bucketed histogram of non-negative values
+        struct Histogram
+        {
+            Histogram();
+            void record(uint64_t);
+            std::string summary(const std::string&, const std::string&) const;
+            uint64_t valueAt(double) const;
+
+            std::vector<uint64_t> buckets;  //bucket b counts values in [2^(b-1), 2^b)
+            uint64_t count;
+            uint64_t sum;
+            uint64_t max;
+        };
+
+        //one client request waiting to be scored
+        struct Request
+        {
+            DecisionTree::Matrix rows;      //samples to score
+            std::vector<int> predictions;   //filled in by worker
+            Clock::time_point enqueued;     //time request was queued
+            std::promise<void> done;        //set once predictions are filled in
+        };
+
+        //global variables
+        const DecisionTree& _model;                 //trained model (only const predict is used)
+        int _nWorkers;                              //# of scoring threads
+        int _maxBatchRows;                          //max # of rows scored together
+        std::chrono::microseconds _batchWait;       //latency budget for filling a batch
+        bool _pinWorkers;                           //pin each worker to its own cpu
+        int _listenFd;                              //listening socket
+        std::string _socketPath;                    //path of listening socket
+        std::atomic<bool> _stopping;                //set to shut down server
+
+        std::mutex _queueMutex;                     //guards _queue and _queuedRows
+        std::condition_variable _queueCond;         //signals new requests/shutdown
+        std::deque<Request*> _queue;                //requests waiting to be scored
+        int _queuedRows;                            //# of rows in _queue
+        std::vector<std::thread> _workers;          //scoring threads
+
+        std::mutex _connMutex;                      //guards _connections
+        std::condition_variable _connCond;          //signals a connection closed
+        std::set<int> _connections;                 //fds of open client connections
+
+        std::mutex _statsMutex;                     //guards histograms
+        Histogram _queueTime;                       //us from enqueue to start of scoring
+        Histogram _batchRows;                       //# of rows per batch
+        Histogram _batchRequests;                   //# of requests per batch
+        Histogram _latency;                         //us from enqueue to predictions ready
+
+        //functions
+        void runWorker(int);
+        void handleConnection(int);
+        bool readFully(int, void*, size_t);
+        bool writeFully(int, const void*, size_t);
+        bool sendResponse(int, uint32_t, uint32_t, const void*, size_t);
+    };
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ *  trees_server.cpp
+ *
+ *  Inference daemon: loads a model saved with saveModel and serves
+ *      predictions on a Unix domain socket (see InferenceServer.h for the
+ *      protocol).  Prints stats on shutdown (SIGINT/SIGTERM).
+ *
+ *  usage: trees_server [-w workers] [-b max batch rows] [-t batch wait us] [-p]
+ *                      <model file> <socket path>
+ */
+
+
+#include <csignal>
+#include <unistd.h>
+
+#include "RandomForest.h"
+#include "InferenceServer.h"
+
+using namespace std;
+using namespace trees;
+
+
+static InferenceServer* server = NULL;
+
+//stops server on SIGINT/SIGTERM
+static void handleSignal(int)
+{
+    if (server != NULL) server->stop();
+}
+
+static void usage()
+{
+    cerr << "usage: trees_server [-w workers] [-b max batch rows] [-t batch wait us] [-p]"
+         << " <model file> <socket path>" << endl;
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int nWorkers = 4;
+    int maxBatchRows = 256;
+    int batchWaitUs = 500;
+    bool pin = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:b:t:p")) != -1) {
+        switch (opt) {
+            case 'w': nWorkers = atoi(optarg); break;
+            case 'b': maxBatchRows = atoi(optarg); break;
+            case 't': batchWaitUs = atoi(optarg); break;
+            case 'p': pin = true; break;
+            default: usage();
+        }
+    }
+    if (argc - optind != 2) usage();
+
+    //load model (a single tree loads as a forest of one)
+    vector<string> features;
+    RandomForest model(features);
+    if (!model.loadModel(argv[optind])) {
+        return 1;
+    }
+    if (model.getTrees().empty()) {
+        cerr << "Error: " << argv[optind] << " has no trees" << endl;
+        return 1;
+    }
+
+    InferenceServer s(model, nWorkers, maxBatchRows, batchWaitUs, pin);
+    server = &s;
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    cerr << "serving " << argv[optind] << " on " << argv[optind+1] << endl;
+    if (!s.serve(argv[optind+1])) {
+        return 1;
+    }
+    cerr << s.getStats();
+    server = NULL;
+    return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ *  CompactForest.cpp
+ *
+ *  Compact Forest: read-only, compacted copy of a trained decision tree or
+ *      random forest for fast, cache-friendly predictions.
+ *
+ *  Compaction:
+ *      (1) each node takes 8 bytes: 16-bit feature index, 16-bit rank of the
+ *          threshold in a per-feature threshold table and a 32-bit index of
+ *          its children (or, for leaves, of its label)
+ *      (2) the two children of a node are stored next to each other, so a
+ *          node only needs the index of its left child
+ *      (3) nodes are built bottom-up; a split whose two children are
+ *          identical (e.g. both leaves with the same label) is replaced by
+ *          the child, and identical child pairs are stored only once, so
+ *          identical subtrees in any of the trees are shared
+ *      (4) to predict, each feature value of a sample is turned into its rank
+ *          among the feature's thresholds once, then all trees compare ranks
+ *
+ *  Profile-guided layout:
+ *      (1) profile() scores representative data and counts visits of each node
+ *      (2) relayout() stores the more visited child of each node first in its
+ *          pair (flagging the parent as inverted if that's the right child),
+ *          and places child pairs depth-first, hot child first, so a hot path
+ *          is a run of consecutive pairs sharing few cache lines
+ *
+ *  Limits: fewer than 32767 features and 65535 thresholds per feature.
+ */
+
+
+#include "CompactForest.h"
+
+using namespace std;
+
+
+namespace trees
+{
+    CompactForest::CompactForest()
+    {
+        _nFeatures = 0;
+    }
+
+    CompactForest::~CompactForest()
+    {
+    }
+
+    //builds compact copy of trained model (decision tree or random forest)
+    bool CompactForest::compact(const DecisionTree& model)
+    {
+        vector<const DecisionTree::Node*> trees = model.getTrees();
+
+        //checks use locals, so a failed compact leaves the current model intact
+        int nFeatures = model.getNumFeatures();
+        if (nFeatures >= FEATURE_MASK) {
+            cerr << "Error: too many features to compact model" << endl;
+            return false;
+        }
+
+        //get sorted thresholds used by each feature
+        vector< vector<int> > thresholds(nFeatures);
+        for (unsigned int i=0; i<trees.size(); i++) {
+            collectThresholds(trees[i], thresholds);
+        }
+        for (int f=0; f<nFeatures; f++) {
+            sort(thresholds[f].begin(), thresholds[f].end());
+            thresholds[f].erase(unique(thresholds[f].begin(), thresholds[f].end()), thresholds[f].end());
+            if (thresholds[f].size() >= LEAF) {
+                cerr << "Error: too many thresholds for feature " << f << " to compact model" << endl;
+                return false;
+            }
+        }
+        _nFeatures = nFeatures;
+        _thresholds.swap(thresholds);
+
+        //get sorted label values (including label for empty nodes)
+        _labels.assign(1, model.getDefaultLabel());
+        for (unsigned int i=0; i<trees.size(); i++) {
+            collectLabels(trees[i], _labels);
+        }
+        sort(_labels.begin(), _labels.end());
+        _labels.erase(unique(_labels.begin(), _labels.end()), _labels.end());
+
+        //pack each tree bottom-up, sharing identical subtrees
+        _roots.clear();
+        _nodes.clear();
+        _pairIndex.clear();
+        for (unsigned int i=0; i<trees.size(); i++) {
+            _roots.push_back(packTree(trees[i], model.getDefaultLabel()));
+        }
+        _pairIndex.clear();
+        _visits.assign(_nodes.size(), 0);
+
+        return true;
+    }
+
+    //adds thresholds of all splits in tree to each feature's list
+    void CompactForest::collectThresholds(const DecisionTree::Node* n, vector< vector<int> >& thresholds)
+    {
+        if (n == NULL || n->isLeaf) return;
+        thresholds[n->spltRule.first].push_back(n->spltRule.second);
+        collectThresholds(n->chld[0], thresholds);
+        collectThresholds(n->chld[1], thresholds);
+    }
+
+    //adds labels of all leaves in tree to list
+    void CompactForest::collectLabels(const DecisionTree::Node* n, vector<int>& labels)
+    {
+        if (n == NULL) return;
+        if (n->isLeaf) {
+            labels.push_back(n->lab);
+        } else {
+            collectLabels(n->chld[0], labels);
+            collectLabels(n->chld[1], labels);
+        }
+    }
+
+    //returns packed leaf node for label
+    CompactForest::PackedNode CompactForest::makeLeaf(int lab)
+    {
+        PackedNode p;
+        p.feature = LEAF;
+        p.threshold = 0;
+        p.next = lower_bound(_labels.begin(), _labels.end(), lab) - _labels.begin();
+        return p;
+    }
+
+    //returns node as a single 64-bit value (for finding identical nodes)
+    uint64_t CompactForest::packedKey(const PackedNode& p) const
+    {
+        return (((uint64_t)p.feature) << 48) | (((uint64_t)p.threshold) << 32) | p.next;
+    }
+
+    //packs subtree rooted at n, returns its (canonical) root node
+    CompactForest::PackedNode CompactForest::packTree(const DecisionTree::Node* n, int defaultLabel)
+    {
+        //empty nodes predict the default label
+        if (n == NULL) return makeLeaf(defaultLabel);
+        if (n->isLeaf) return makeLeaf(n->lab);
+
+        PackedNode left = packTree(n->chld[0], defaultLabel);
+        PackedNode right = packTree(n->chld[1], defaultLabel);
+
+        //split can't change prediction if both children are the same subtree
+        uint64_t leftKey = packedKey(left);
+        uint64_t rightKey = packedKey(right);
+        if (leftKey == rightKey) return left;
+
+        //store child pair once, reuse it for identical subtrees
+        pair<uint64_t, uint64_t> key(leftKey, rightKey);
+        map< pair<uint64_t, uint64_t>, uint32_t >::iterator it = _pairIndex.find(key);
+        uint32_t index;
+        if (it == _pairIndex.end()) {
+            index = _nodes.size();
+            _nodes.push_back(left);
+            _nodes.push_back(right);
+            _pairIndex[key] = index;
+        } else {
+            index = it->second;
+        }
+
+        PackedNode p;
+        p.feature = n->spltRule.first;
+        const vector<int>& t = _thresholds[n->spltRule.first];
+        p.threshold = lower_bound(t.begin(), t.end(), n->spltRule.second) - t.begin();
+        p.next = index;
+        return p;
+    }
+
+    //replaces each feature value by # of the feature's thresholds <= value
+    //  (so value >= threshold[r] exactly when bin > r)
+    void CompactForest::binSample(const vector<int>& sample, vector<uint16_t>& bins) const
+    {
+        for (int f=0; f<_nFeatures; f++) {
+            const vector<int>& t = _thresholds[f];
+            bins[f] = upper_bound(t.begin(), t.end(), sample[f]) - t.begin();
+        }
+    }
+
+    //makes label predictions (mode over trees for a forest); const and
+    //  safe to call from many threads at once
+    void CompactForest::predict(const DecisionTree::Matrix& testData, vector<int>& predictions) const
+    {
+        predictSamples(testData, predictions, NULL);
+    }
+
+    //makes label predictions while counting visits of each node, for relayout()
+    void CompactForest::profile(const DecisionTree::Matrix& testData, vector<int>& predictions)
+    {
+        _visits.resize(_nodes.size(), 0);
+        predictSamples(testData, predictions, _visits.empty() ? NULL : &_visits[0]);
+    }
+
+    //makes label predictions, adds node visits to visits if not NULL
+    void CompactForest::predictSamples(const DecisionTree::Matrix& testData, vector<int>& predictions, uint64_t* visits) const
+    {
+        predictions.resize(testData.size());
+        if (_roots.size() == 0) {
+            cerr << "Error: compact model is empty" << endl;
+            return;
+        }
+
+        vector<uint16_t> bins(_nFeatures);
+        vector<int> votes(_labels.size());
+        const PackedNode* nodes = _nodes.empty() ? NULL : &_nodes[0];
+
+        for (unsigned int i=0; i<testData.size(); i++) {
+
+            binSample(testData[i], bins);
+            fill(votes.begin(), votes.end(), 0);
+
+            //go down each tree, comparing ranks instead of values
+            for (unsigned int t=0; t<_roots.size(); t++) {
+                PackedNode n = _roots[t];
+                while (n.feature != LEAF) {
+                    uint32_t c = n.next + ((bins[n.feature & FEATURE_MASK] > n.threshold) ^ (n.feature >> 15));
+                    if (visits != NULL) visits[c]++;
+                    n = nodes[c];
+                }
+                votes[n.next]++;
+            }
+
+            //most frequent label (smallest label on ties)
+            int best = 0;
+            for (unsigned int l=1; l<votes.size(); l++) {
+                if (votes[l] > votes[best]) best = l;
+            }
+            predictions[i] = _labels[best];
+        }
+    }
+
+    //lays out nodes again using visit counts from profile(), then clears counts
+    void CompactForest::relayout()
+    {
+        vector<PackedNode> nodes;
+        nodes.reserve(_nodes.size());
+        vector<int> newPair(_nodes.size()/2, -1);
+        vector<char> swapped(_nodes.size()/2, 0);
+
+        for (unsigned int t=0; t<_roots.size(); t++) {
+            _roots[t] = relayoutNode(_roots[t], nodes, newPair, swapped);
+        }
+        _nodes.swap(nodes);
+        _visits.assign(_nodes.size(), 0);
+    }
+
+    //places child pair of node n (hot child first, then both subtrees, hot first)
+    //  unless already placed; returns n pointing at the pair's new position
+    CompactForest::PackedNode CompactForest::relayoutNode(PackedNode n, vector<PackedNode>& nodes,
+                                                          vector<int>& newPair, vector<char>& swapped)
+    {
+        if (n.feature == LEAF) return n;
+
+        uint32_t old = n.next;
+        int pair = old/2;
+
+        //shared pairs are placed the first time they're reached
+        if (newPair[pair] < 0) {
+            int hot = (_visits[old+1] > _visits[old]) ? 1 : 0;
+            int slot = nodes.size();
+            newPair[pair] = slot;
+            swapped[pair] = hot;
+            nodes.resize(slot + 2);
+
+            //hot child's own pair goes right after this one
+            PackedNode hotNode = relayoutNode(_nodes[old + hot], nodes, newPair, swapped);
+            nodes[slot] = hotNode;
+            PackedNode coldNode = relayoutNode(_nodes[old + 1 - hot], nodes, newPair, swapped);
+            nodes[slot + 1] = coldNode;
+        }
+
+        //flip inverted flag if pair's children were swapped
+        n.next = newPair[pair];
+        if (swapped[pair]) n.feature ^= INVERTED;
+        return n;
+    }
+
+    //returns number of trees
+    int CompactForest::getNumTrees() const
+    {
+        return _roots.size();
+    }
+
+    //returns number of stored nodes (shared nodes counted once)
+    int CompactForest::getNumNodes() const
+    {
+        return _roots.size() + _nodes.size();
+    }
+
+    //returns approximate memory used by model in bytes
+    size_t CompactForest::getMemoryUsage() const
+    {
+        size_t bytes = (_roots.size() + _nodes.size())*sizeof(PackedNode) + _labels.size()*sizeof(int);
+        for (unsigned int f=0; f<_thresholds.size(); f++) {
+            bytes += _thresholds[f].size()*sizeof(int);
+        }
+        return bytes;
+    }
+}
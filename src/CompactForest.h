@@ -0,0 +1,78 @@
+/*
+ *  CompactForest.h
+ *
+ *  Compact Forest: read-only, compacted copy of a trained decision tree or
+ *      random forest for fast, cache-friendly predictions.  Each node is
+ *      packed into 8 bytes, identical subtrees are stored once and splits
+ *      that can't change the prediction are removed.  Nodes can be laid out
+ *      again using branch frequencies recorded on representative data.
+ */
+
+#ifndef CompactForest_H
+#define CompactForest_H
+
+#include <stdint.h>
+
+#include "DecisionTree.h"
+
+
+namespace trees {
+
+    class CompactForest
+    {
+
+    public:
+
+        //constructor/destructor
+        CompactForest();
+        virtual ~CompactForest();
+
+        //node packed into 8 bytes
+        struct PackedNode
+        {
+            uint16_t feature;       //split feature index, top bit set if children are swapped (LEAF for leaf nodes)
+            uint16_t threshold;     //rank of threshold in feature's threshold table
+            uint32_t next;          //split: index of child pair (left child first unless inverted); leaf: label index
+        };
+
+        //marks a leaf node in PackedNode::feature
+        static const uint16_t LEAF = 0xFFFF;
+        
+        //PackedNode::feature bits: set if right child is stored first, mask for feature index
+        static const uint16_t INVERTED = 0x8000;
+        static const uint16_t FEATURE_MASK = 0x7FFF;
+
+        //functions
+        bool compact(const DecisionTree&);
+        void predict(const DecisionTree::Matrix&, std::vector<int>&) const;
+        void profile(const DecisionTree::Matrix&, std::vector<int>&);
+        void relayout();
+        int getNumTrees() const;
+        int getNumNodes() const;
+        size_t getMemoryUsage() const;
+
+
+    protected:
+
+        //global variables
+        std::vector<PackedNode> _roots;                 //root node of each tree
+        std::vector<PackedNode> _nodes;                 //child nodes, stored in (left, right) pairs
+        std::vector< std::vector<int> > _thresholds;    //sorted split thresholds of each feature
+        std::vector<int> _labels;                       //sorted label values (leaves store index)
+        int _nFeatures;                                 //number of features
+        std::map< std::pair<uint64_t, uint64_t>, uint32_t > _pairIndex;    //child pair -> index in _nodes (build only)
+        std::vector<uint64_t> _visits;                  //# of times each node in _nodes was visited by profile
+
+        //functions
+        void collectThresholds(const DecisionTree::Node*, std::vector< std::vector<int> >&);
+        void collectLabels(const DecisionTree::Node*, std::vector<int>&);
+        PackedNode packTree(const DecisionTree::Node*, int);
+        PackedNode makeLeaf(int);
+        uint64_t packedKey(const PackedNode&) const;
+        void binSample(const std::vector<int>&, std::vector<uint16_t>&) const;
+        void predictSamples(const DecisionTree::Matrix&, std::vector<int>&, uint64_t*) const;
+        PackedNode relayoutNode(PackedNode, std::vector<PackedNode>&, std::vector<int>&, std::vector<char>&);
+    };
+}
+
+#endif
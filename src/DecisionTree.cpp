@@ -10,6 +10,21 @@
  *      (3) for given integer threshold value t: split [ , t) & [t, ]
  *      (4) assumes all feature values are integers
  *      (5) stops when data in each node has same label or min node size reached
+ *          (optionally also at a max depth or max number of leaves)
+ *      (6) grows depth-first by default; level-wise and best-first growth
+ *          work on sample indices, gathering split statistics for each node
+ *          in a single pass over its samples
+ *      (7) extra-trees mode tries one random threshold per feature instead of
+ *          every observed value
+ *      (8) training, CV and prediction read features through a DataView (of a
+ *          Matrix or of a strided row-/column-major buffer) and pass sets of
+ *          row indices around instead of copies of the data
+ *      (9) optionally, candidate thresholds are a bounded number of quantiles
+ *          of each feature, taken from quantile sketches built in one pass
+ *          over the data, instead of every observed value
+ *      (10) training runs report progress and can be cancelled, or stopped by
+ *          a time or memory budget, from another thread; a stopped tree keeps
+ *          the nodes built so far (forests drop the unfinished tree instead)
  *
  *  Created by Kelsey Schuster
  *  11/3/15
@@ -17,12 +32,24 @@
 
 
 #include "DecisionTree.h"
+#include "QuantileSketch.h"
+
+#include <climits>
+#include <time.h>
 
 using namespace std;
 
 
 namespace trees
 {
+    //returns seconds on a clock that never goes backwards
+    static double monotonicTime()
+    {
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + 1e-9*t.tv_nsec;
+    }
+    
     DecisionTree::Node::Node()
     {
     }
@@ -34,6 +61,7 @@ namespace trees
     DecisionTree::Node::Node(int n)
     {
         isLeaf = false;
+        id = -1;
     }
     
     DecisionTree::Node::Node(const Node& n)
@@ -42,6 +70,7 @@ namespace trees
         chld = n.chld;
         isLeaf = n.isLeaf;
         lab = n.lab;
+        id = n.id;
     }
     
     const DecisionTree::Node& DecisionTree::Node::operator=(const Node& n)
@@ -50,9 +79,34 @@ namespace trees
         chld = n.chld;
         isLeaf = n.isLeaf;
         lab = n.lab;
+        id = n.id;
         return *this;
     }
     
+    //view of a strided buffer: value (r, c) is at data[r*rowStride + c*colStride]
+    DecisionTree::DataView::DataView(const int* data, int rows, int cols, long rowStride, long colStride)
+    {
+        _data = data;
+        _rows = rows;
+        _cols = cols;
+        _rowStride = rowStride;
+        _colStride = colStride;
+    }
+    
+    //view of a Matrix (stores a pointer to each row, values aren't copied)
+    DecisionTree::DataView::DataView(const Matrix& m)
+    : _rowTable(m.size())
+    {
+        _data = NULL;
+        _rows = m.size();
+        _cols = (m.size() > 0) ? m[0].size() : 0;
+        _rowStride = 0;
+        _colStride = 1;
+        for (unsigned int i=0; i<m.size(); i++) {
+            _rowTable[i] = m[i].empty() ? NULL : &m[i][0];
+        }
+    }
+    
     //initialize model and set features
     DecisionTree::DecisionTree(vector<string>& features)
     : _features(features)
@@ -71,10 +125,43 @@ namespace trees
         
         //don't follow any samples when making predictions
         _followSampleIndex = -1;
+        
+        //grow depth-first with no depth/leaf budgets by default
+        _growthMode = DEPTH_FIRST;
+        _maxDepth = -1;
+        _maxLeaves = -1;
+        
+        //random numbers are seeded from the clock unless setSeed is called
+        _seedSet = false;
+        _seed = 0;
+        _randState = time(NULL);
+        
+        //search all observed thresholds
+        _randomThresholds = false;
+        _sketchThresholds = 0;
+        _sketchSize = 200;
+        
+        //no budgets, no training run yet
+        _timeBudget = -1.0;
+        _memoryBudget = -1;
+        _progress.running = false;
+        _progress.treesDone = 0;
+        _progress.treesTotal = 0;
+        _progress.nodesBuilt = 0;
+        _progress.memoryUsed = 0;
+        _progress.elapsed = 0.0;
+        _progress.eta = -1.0;
+        _progress.stopReason = COMPLETED;
+        _treeNodes = 0;
+        _cancelRequested = false;
+        _trainingPending = false;
+        _trainStart = 0.0;
+        pthread_mutex_init(&_progressMutex, NULL);
     }
     
     DecisionTree::~DecisionTree()
     {
+        pthread_mutex_destroy(&_progressMutex);
         cerr << "finished" << endl;
     }
     
@@ -84,6 +171,187 @@ namespace trees
         _vocal = v;
     }
     
+    //sets order in which nodes are expanded when growing trees
+    void DecisionTree::setGrowthMode(GrowthMode g)
+    {
+        _growthMode = g;
+        if (_growthMode == DEPTH_FIRST && _maxLeaves >= 0) {
+            cerr << "Warning: max # of leaves is ignored when growing depth-first" << endl;
+        }
+    }
+    
+    //sets max depth of trees (-1 for no limit)
+    void DecisionTree::setMaxDepth(int d)
+    {
+        _maxDepth = d;
+    }
+    
+    //sets max # of leaf nodes per tree (-1 for no limit); level-wise/best-first
+    //  only, warns if trees are grown depth-first
+    void DecisionTree::setMaxLeaves(int l)
+    {
+        _maxLeaves = l;
+        if (_growthMode == DEPTH_FIRST && _maxLeaves >= 0) {
+            cerr << "Warning: max # of leaves is ignored when growing depth-first" << endl;
+        }
+    }
+    
+    //only tries up to nThresholds quantiles of each feature as split thresholds,
+    //  taken from quantile sketches of given size (0 thresholds: all values)
+    void DecisionTree::setQuantileSketch(int nThresholds, int sketchSize)
+    {
+        _sketchThresholds = (nThresholds > 0) ? nThresholds : 0;
+        _sketchSize = sketchSize;
+    }
+    
+    //stops each training run after given # of seconds (-1 for no limit); a
+    //  forest keeps the trees finished in time
+    void DecisionTree::setTimeBudget(double seconds)
+    {
+        pthread_mutex_lock(&_progressMutex);
+        _timeBudget = seconds;
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //stops each training run once its nodes take about given # of bytes (-1
+    //  for no limit); a forest keeps the trees finished within budget
+    void DecisionTree::setMemoryBudget(long bytes)
+    {
+        pthread_mutex_lock(&_progressMutex);
+        _memoryBudget = bytes;
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //asks current training run (or one a job is about to begin) to stop; has
+    //  no effect when no run is active, so it never stops a later run; safe to
+    //  call from another thread
+    void DecisionTree::cancelTraining()
+    {
+        pthread_mutex_lock(&_progressMutex);
+        if (_progress.running || _trainingPending) {
+            _cancelRequested = true;
+        }
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //returns progress of current (or last) training run; safe to call from
+    //  another thread
+    DecisionTree::TrainingProgress DecisionTree::getProgress() const
+    {
+        pthread_mutex_lock(&_progressMutex);
+        TrainingProgress p = _progress;
+        double trainStart = _trainStart;
+        double timeBudget = _timeBudget;
+        pthread_mutex_unlock(&_progressMutex);
+        
+        if (!p.running) return p;
+        
+        //estimate time left from average time per finished tree
+        p.elapsed = monotonicTime() - trainStart;
+        if (p.treesDone > 0) {
+            p.eta = p.elapsed/p.treesDone*(p.treesTotal - p.treesDone);
+            if (timeBudget >= 0 && p.eta > timeBudget - p.elapsed) {
+                p.eta = std::max(0.0, timeBudget - p.elapsed);
+            }
+        }
+        return p;
+    }
+    
+    //marks model as about to begin a run (so cancelTraining applies before the
+    //  run starts), or releases it; clears any cancel request either way
+    void DecisionTree::reserveTraining(bool pending)
+    {
+        pthread_mutex_lock(&_progressMutex);
+        _trainingPending = pending;
+        _cancelRequested = false;
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //starts progress reporting for a run training nTrees trees (keeps a cancel
+    //  request made while the run was pending)
+    void DecisionTree::beginTraining(int nTrees)
+    {
+        pthread_mutex_lock(&_progressMutex);
+        _trainingPending = false;
+        _progress.running = true;
+        _progress.treesDone = 0;
+        _progress.treesTotal = nTrees;
+        _progress.nodesBuilt = 0;
+        _progress.memoryUsed = 0;
+        _progress.elapsed = 0.0;
+        _progress.eta = -1.0;
+        _progress.stopReason = COMPLETED;
+        _treeNodes = 0;
+        _trainStart = monotonicTime();
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //returns true if run has to stop (cancelled or out of budget), otherwise
+    //  counts nNodes new nodes of the current tree and returns false
+    bool DecisionTree::checkTrainingBudgets(int nNodes)
+    {
+        pthread_mutex_lock(&_progressMutex);
+        if (_progress.stopReason == COMPLETED) {
+            if (_cancelRequested) {
+                _progress.stopReason = CANCELLED;
+            } else if (_timeBudget >= 0 && monotonicTime() - _trainStart > _timeBudget) {
+                _progress.stopReason = TIME_BUDGET;
+            } else if (_memoryBudget >= 0 && _progress.memoryUsed >= _memoryBudget) {
+                _progress.stopReason = MEMORY_BUDGET;
+            } else {
+                _treeNodes += nNodes;
+                _progress.nodesBuilt += nNodes;
+                _progress.memoryUsed += nNodes*(long)(sizeof(Node) + 2*sizeof(Node*));
+            }
+        }
+        bool stopped = (_progress.stopReason != COMPLETED);
+        pthread_mutex_unlock(&_progressMutex);
+        return stopped;
+    }
+    
+    //returns true once the run has been stopped (trees grown since are cut short)
+    bool DecisionTree::trainingStopped() const
+    {
+        pthread_mutex_lock(&_progressMutex);
+        bool stopped = (_progress.stopReason != COMPLETED);
+        pthread_mutex_unlock(&_progressMutex);
+        return stopped;
+    }
+    
+    //counts current tree as finished, or takes back its nodes if it's dropped
+    void DecisionTree::finishTree(bool kept)
+    {
+        pthread_mutex_lock(&_progressMutex);
+        if (kept) {
+            _progress.treesDone++;
+        } else {
+            _progress.nodesBuilt -= _treeNodes;
+            _progress.memoryUsed -= _treeNodes*(long)(sizeof(Node) + 2*sizeof(Node*));
+        }
+        _treeNodes = 0;
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //ends progress reporting for run (clears any cancel request)
+    void DecisionTree::endTraining()
+    {
+        pthread_mutex_lock(&_progressMutex);
+        _progress.running = false;
+        _progress.elapsed = monotonicTime() - _trainStart;
+        _progress.eta = 0.0;
+        _cancelRequested = false;
+        pthread_mutex_unlock(&_progressMutex);
+    }
+    
+    //seeds random number generator (for reproducible feature choices, CV folds
+    //  and bootstrap samples)
+    void DecisionTree::setSeed(unsigned int seed)
+    {
+        _seedSet = true;
+        _seed = seed;
+        _randState = seed;
+    }
+    
     //sets the sample whose splits we record when making predictions
     void DecisionTree::followSample(int s)
     {
@@ -93,47 +361,101 @@ namespace trees
     //train decision tree with input training data
     void DecisionTree::trainDecisionTree(Matrix& trainData, std::vector<int>& trainLabels, int minSize) 
     {
-        //set min # of samples each node can contain
-        _minNodeSize = minSize;
-        
+        if (trainData.size() != trainLabels.size()) {
+            cerr << "Error: need same number of samples in data and labels" << endl;
+            exit(1);
+        }
+        trainDecisionTree(DataView(trainData), trainLabels.empty() ? NULL : &trainLabels[0], minSize);
+    }
+    
+    //train decision tree directly on a data view, one label per row of the view
+    void DecisionTree::trainDecisionTree(const DataView& trainData, const int* trainLabels, int minSize)
+    {
         //check to make sure correct # of features
-        if (trainData.size() == 0 || trainData[0].size() != _nFeatures) {
+        if (trainData.rows() == 0 || trainData.cols() != _nFeatures) {
             cerr << "Error: incorrect number of features" << endl;
             exit(1);
         }
         
+        //train on every row of the view (if stopped early, keep the partial tree)
+        vector<int> samples(trainData.rows());
+        for (int i=0; i<trainData.rows(); i++) {
+            samples[i] = i;
+        }
+        beginTraining(1);
+        trainOnSamples(trainData, trainLabels, samples, minSize);
+        finishTree(true);
+        endTraining();
+    }
+    
+    //trains tree on the given rows of the view (rows may repeat, e.g. bootstrap samples)
+    void DecisionTree::trainOnSamples(const DataView& trainData, const int* trainLabels, vector<int>& samples, int minSize)
+    {
+        //set min # of samples each node can contain
+        _minNodeSize = minSize;
+        
         //get possible values for sample label (assumes discrete values)
-        _labelValues = getLabelValues(trainLabels);
+        _labelValues = getLabelValues(trainLabels, samples);
         
         //set default label by finding most probable (assume same distr)
-        _defaultLabel = getLabelMode(trainLabels);
+        _defaultLabel = getLabelMode(getSampleLabels(trainLabels, samples));
         
-        //get possible values for each feature
-        _featureValues = getFeatureValues(trainData);
+        //get possible values (or sketched thresholds) for each feature (not
+        //  needed for random thresholds)
+        if (_randomThresholds) {
+            _featureValues.clear();
+        } else if (_sketchThresholds > 0) {
+            _featureValues = getSketchThresholds(trainData, samples);
+        } else {
+            _featureValues = getFeatureValues(trainData, samples);
+        }
+        
+        //index of each sample's label in _labelValues, built once per tree
+        vector<int> labelIndex = getLabelIndex(trainData, trainLabels, samples);
         
         //build classification tree
         Node* root = (Node*) new DecisionTree::Node(2);
-        buildDecisionTree(trainData, trainLabels, root);
+        if (_growthMode == DEPTH_FIRST) {
+            buildDecisionTree(trainData, trainLabels, labelIndex, samples, root);
+        } else {
+            growTree(trainData, labelIndex, samples, root);
+        }
         
-        //save classifier for future use
+        //number nodes for decision paths, save classifier for future use
+        int id = 0;
+        numberNodes(root, id);
         _root = root;
     }
     
     
     //given data + labels, param num + values to test, performs k-fold CV
     map<int, double> DecisionTree::performCrossValidation(Matrix& data, vector<int>& labels, vector<int>& paramVals, int param, int k)
+    {
+        if (data.size() != labels.size()) {
+            cerr << "Error: need same number of samples in data and labels" << endl;
+            return map<int, double>();
+        }
+        return performCrossValidation(DataView(data), labels.empty() ? NULL : &labels[0], paramVals, param, k);
+    }
+    
+    //k-fold CV of min node size directly on a data view; folds are sets of row indices
+    map<int, double> DecisionTree::performCrossValidation(const DataView& data, const int* labels, vector<int>& paramVals, int param, int k)
     {
         // param = 1: minNodeSize
         
         double invK = 1.0/((double)k);
-        Matrix validData, trainData;
-        vector<int> validLabels, trainLabels;
+        vector<int> validSamples, trainSamples;
         
-        //randomize data and labels
-        randomizeSamples(data, labels);
+        //randomize order of samples
+        vector<int> order(data.rows());
+        for (int i=0; i<data.rows(); i++) {
+            order[i] = i;
+        }
+        randomizeSamples(order);
         
         //data structure for param values with corresp CV accuracy
         map<int, double> accuracyStore;
+        beginTraining(paramVals.size()*k);
         
         //iterate through parameter values
         for (unsigned int i=0; i<paramVals.size(); i++) {
@@ -141,111 +463,485 @@ namespace trees
             if (_vocal) cout << "parameter value " << paramVals[i] << endl;
             
             //iterate through 1:k (k-fold cross-validation)
+            int foldsDone = 0;
             for (unsigned int j=0; j<k; j++) {
                 
                 if (_vocal) cout << "\tk: " << j << endl;
                 
-                //pull out validation data and training data
-                for (unsigned int n=0; n<data.size(); n++) {
-                    if ((n >= (int)(j*data.size()*invK)) && (n < (int)((j+1)*data.size()*invK))) {
-                        validData.push_back(data[n]);
-                        validLabels.push_back(labels[n]);
-                    } else {
-                        trainData.push_back(data[n]);
-                        trainLabels.push_back(labels[n]);
-                    }
-                }
+                //stop if cancelled or out of budget
+                if (checkTrainingBudgets(0)) break;
                 
-                //train tree with selected training data
-                trainDecisionTree(trainData, trainLabels, paramVals[i]);
+                //pull out validation samples and training samples
+                splitFold(order, j, k, trainSamples, validSamples);
                 
-                //make predictions for selected validation set
-                vector<int> predictions(validData.size(), -1);
-                makePredictions(validData, predictions);
+                //train tree with selected training samples
+                trainOnSamples(data, labels, trainSamples, paramVals[i]);
+                
+                //a tree cut short doesn't count
+                if (trainingStopped()) {
+                    finishTree(false);
+                    break;
+                }
                 
                 //compute and store validation accuracy
-                accuracyStore[paramVals[i]] += invK*computeValidationAccuracy(predictions, validLabels);
+                accuracyStore[paramVals[i]] += invK*sampleAccuracy(data, labels, validSamples);
+                foldsDone++;
+                finishTree(true);
                 
                 //clear data structures
-                validData.clear();
-                validLabels.clear();
-                trainData.clear(); 
-                trainLabels.clear();
+                validSamples.clear();
+                trainSamples.clear();
+            }
+            
+            //if stopped, last value's accuracy is the mean over its finished folds
+            if (foldsDone < k) {
+                if (foldsDone > 0) {
+                    accuracyStore[paramVals[i]] *= ((double)k)/foldsDone;
+                }
+                break;
+            }
+        }
+        endTraining();
+        return accuracyStore;
+    }
+    
+    //given data + labels and cost-complexity penalties (alpha), performs k-fold CV
+    //  of pruned trees (min node size minSize); one tree is grown per fold and
+    //  pruned for increasing alpha
+    map<double, double> DecisionTree::crossValidatePruning(Matrix& data, vector<int>& labels, vector<double>& alphas, int minSize, int k)
+    {
+        if (data.size() != labels.size()) {
+            cerr << "Error: need same number of samples in data and labels" << endl;
+            return map<double, double>();
+        }
+        return crossValidatePruning(DataView(data), labels.empty() ? NULL : &labels[0], alphas, minSize, k);
+    }
+    
+    //k-fold CV of cost-complexity penalties directly on a data view
+    map<double, double> DecisionTree::crossValidatePruning(const DataView& data, const int* labels, vector<double>& alphas, int minSize, int k)
+    {
+        double invK = 1.0/((double)k);
+        vector<int> validSamples, trainSamples;
+        
+        //pruning for a larger alpha continues from the tree pruned for a smaller one
+        vector<double> sortedAlphas = alphas;
+        sort(sortedAlphas.begin(), sortedAlphas.end());
+        
+        //randomize order of samples
+        vector<int> order(data.rows());
+        for (int i=0; i<data.rows(); i++) {
+            order[i] = i;
+        }
+        randomizeSamples(order);
+        
+        //data structure for alpha values with corresp CV accuracy
+        map<double, double> accuracyStore;
+        beginTraining(k);
+        
+        //iterate through 1:k (k-fold cross-validation)
+        int foldsDone = 0;
+        for (int j=0; j<k; j++) {
+            
+            if (_vocal) cout << "\tk: " << j << endl;
+            
+            //stop if cancelled or out of budget
+            if (checkTrainingBudgets(0)) break;
+            
+            //pull out validation samples and training samples
+            splitFold(order, j, k, trainSamples, validSamples);
+            
+            //free tree from previous fold, train full tree with selected training samples
+            if (j > 0) deleteTree(_root);
+            trainOnSamples(data, labels, trainSamples, minSize);
+            
+            //a tree cut short doesn't count
+            if (trainingStopped()) {
+                finishTree(false);
+                break;
+            }
+            
+            for (unsigned int i=0; i<sortedAlphas.size(); i++) {
+                
+                pruneRoot(_root, data, labels, trainSamples, sortedAlphas[i]);
+                
+                //compute and store validation accuracy
+                accuracyStore[sortedAlphas[i]] += invK*sampleAccuracy(data, labels, validSamples);
+            }
+            foldsDone++;
+            finishTree(true);
+            
+            //clear data structures
+            validSamples.clear();
+            trainSamples.clear();
+        }
+        
+        //if stopped, accuracies are the means over the finished folds
+        if (foldsDone > 0 && foldsDone < k) {
+            for (map<double, double>::iterator it = accuracyStore.begin(); it != accuracyStore.end(); ++it) {
+                it->second *= ((double)k)/foldsDone;
             }
         }
+        endTraining();
         return accuracyStore;
     }
+    
+    //puts samples in fold j of k (positions in order) in validation set, all others in training set
+    void DecisionTree::splitFold(vector<int>& order, int j, int k, vector<int>& trainSamples, vector<int>& validSamples)
+    {
+        double invK = 1.0/((double)k);
+        for (unsigned int n=0; n<order.size(); n++) {
+            if ((n >= (int)(j*order.size()*invK)) && (n < (int)((j+1)*order.size()*invK))) {
+                validSamples.push_back(order[n]);
+            } else {
+                trainSamples.push_back(order[n]);
+            }
+        }
+    }
+    
+    //returns fraction of given samples whose label the current tree (_root) predicts
+    double DecisionTree::sampleAccuracy(const DataView& data, const int* labels, vector<int>& samples) const
+    {
+        int accurate = 0;
+        for (unsigned int i=0; i<samples.size(); i++) {
+            if (predictSample(_root, data.row(samples[i]), data.colStride()) == labels[samples[i]]) {
+                accurate++;
+            }
+        }
+        return ((double)accurate)/((double)samples.size());
+    }
+    
+    //returns cost-complexity pruning path of tree on given data, computed in
+    //  one bottom-up pass; step i is the optimal subtree for alpha in
+    //  [step i alpha, step i+1 alpha), alpha in units of misclassification rate
+    vector<DecisionTree::PruningStep> DecisionTree::computePruningPath(Matrix& data, vector<int>& labels)
+    {
+        vector<int> samples(data.size());
+        for (unsigned int i=0; i<data.size(); i++) {
+            samples[i] = i;
+        }
+        vector<PruningStep> path = pruningCost(_root, DataView(data), labels.empty() ? NULL : &labels[0], samples);
+        
+        //convert counts to rates
+        double invN = (data.size() > 0) ? 1.0/((double)data.size()) : 0.0;
+        for (unsigned int i=0; i<path.size(); i++) {
+            path[i].alpha *= invN;
+            path[i].error *= invN;
+        }
+        return path;
+    }
+    
+    //prunes tree to the subtree minimizing error rate + alpha * # leaves on the
+    //  given data (training data: cost-complexity pruning; held-out data with
+    //  alpha=0: reduced-error pruning); returns # of leaves left
+    int DecisionTree::pruneTree(Matrix& data, vector<int>& labels, double alpha)
+    {
+        vector<int> samples(data.size());
+        for (unsigned int i=0; i<data.size(); i++) {
+            samples[i] = i;
+        }
+        return pruneRoot(_root, DataView(data), labels.empty() ? NULL : &labels[0], samples, alpha);
+    }
+    
+    //prunes tree rooted at root using the given rows of data, returns # of leaves left
+    int DecisionTree::pruneRoot(Node* root, const DataView& data, const int* labels, vector<int>& samples, double alpha)
+    {
+        int nLeaves = 0;
+        pruneSubtree(root, data, labels, samples, alpha*samples.size(), nLeaves);
+        
+        //renumber remaining nodes
+        int id = 0;
+        numberNodes(root, id);
+        return nLeaves;
+    }
+    
+    //returns # of samples whose label isn't lab
+    int DecisionTree::countErrors(const int* labels, vector<int>& samples, int lab)
+    {
+        int errors = 0;
+        for (unsigned int i=0; i<samples.size(); i++) {
+            if (labels[samples[i]] != lab) errors++;
+        }
+        return errors;
+    }
+    
+    //sends samples reaching split node n to its left or right child
+    void DecisionTree::partitionSamples(const DataView& data, const Node* n, vector<int>& samples,
+                                        vector<int>& left, vector<int>& right)
+    {
+        for (unsigned int i=0; i<samples.size(); i++) {
+            int s = samples[i];
+            if (data(s, n->spltRule.first) < n->spltRule.second) {
+                left.push_back(s);
+            } else {
+                right.push_back(s);
+            }
+        }
+    }
+    
+    //returns optimal cost (errors + alpha * leaves) of subtree at n as a piecewise
+    //  linear function of alpha: one step per segment, alpha in # of samples
+    vector<DecisionTree::PruningStep> DecisionTree::pruningCost(const Node* n, const DataView& data,
+                                                                const int* labels, vector<int>& samples)
+    {
+        vector<PruningStep> cost;
+        PruningStep leaf;
+        leaf.alpha = 0.0;
+        leaf.nLeaves = 1;
+        leaf.error = countErrors(labels, samples, (n == NULL) ? _defaultLabel : n->lab);
+        
+        //empty nodes and leaves can't be pruned further
+        if (n == NULL || n->isLeaf) {
+            cost.push_back(leaf);
+            return cost;
+        }
+        
+        vector<int> s[2];
+        partitionSamples(data, n, samples, s[0], s[1]);
+        vector<PruningStep> left = pruningCost(n->chld[0], data, labels, s[0]);
+        vector<PruningStep> right = pruningCost(n->chld[1], data, labels, s[1]);
+        
+        //cost of keeping the split: sum of children, segments start at either child's breakpoints
+        unsigned int l = 0, r = 0;
+        while (l < left.size() && r < right.size()) {
+            PruningStep step;
+            step.alpha = std::max(left[l].alpha, right[r].alpha);
+            step.nLeaves = left[l].nLeaves + right[r].nLeaves;
+            step.error = left[l].error + right[r].error;
+            cost.push_back(step);
+            
+            //advance whichever child has the next breakpoint
+            double nextL = (l+1 < left.size()) ? left[l+1].alpha : -1.0;
+            double nextR = (r+1 < right.size()) ? right[r+1].alpha : -1.0;
+            if (nextL < 0 && nextR < 0) break;
+            if (nextR < 0 || (nextL >= 0 && nextL <= nextR)) l++;
+            if (nextL < 0 || (nextR >= 0 && nextR <= nextL)) r++;
+        }
+        
+        //split has slope >= 2 in alpha, so it stops paying off at a single alpha
+        //  where its cost reaches the cost of turning n into a leaf
+        for (unsigned int i=0; i<cost.size(); i++) {
+            double end = (i+1 < cost.size()) ? cost[i+1].alpha : -1.0;
+            double cross = (leaf.error - cost[i].error)/(cost[i].nLeaves - 1);
+            if (end < 0 || cross <= end) {
+                leaf.alpha = std::max(cost[i].alpha, cross);
+                cost.resize(i+1);
+                if (cost[i].alpha >= leaf.alpha) cost.pop_back();
+                break;
+            }
+        }
+        cost.push_back(leaf);
+        return cost;
+    }
+    
+    //prunes subtree at n for penalty alpha (per leaf, in # of samples);
+    //  returns its cost and adds its # of leaves to nLeaves
+    double DecisionTree::pruneSubtree(Node* n, const DataView& data, const int* labels, vector<int>& samples,
+                                      double alpha, int& nLeaves)
+    {
+        double leafCost = countErrors(labels, samples, (n == NULL) ? _defaultLabel : n->lab) + alpha;
+        if (n == NULL || n->isLeaf) {
+            nLeaves++;
+            return leafCost;
+        }
+        
+        vector<int> s[2];
+        partitionSamples(data, n, samples, s[0], s[1]);
+        int splitLeaves = 0;
+        double splitCost = 0.0;
+        for (unsigned int i=0; i<2; i++) {
+            splitCost += pruneSubtree(n->chld[i], data, labels, s[i], alpha, splitLeaves);
+        }
+        
+        //turn node into a leaf if split doesn't lower the cost
+        if (leafCost <= splitCost) {
+            for (unsigned int i=0; i<n->chld.size(); i++) {
+                deleteTree(n->chld[i]);
+            }
+            n->chld.clear();
+            n->isLeaf = true;
+            nLeaves++;
+            return leafCost;
+        }
+        nLeaves += splitLeaves;
+        return splitCost;
+    }
      
     
     //given test data and current decision tree (_root), make label predictions
+    //  (records splits of the sample set with followSample)
     void DecisionTree::makePredictions(Matrix& testData, vector<int>& predictions)
     {
+        predictions.resize(testData.size());
+        makePredictions(DataView(testData), predictions.empty() ? NULL : &predictions[0]);
+    }
+    
+    //makes label predictions for each row of a data view, writing one label per
+    //  row to predictions (records splits of the sample set with followSample)
+    void DecisionTree::makePredictions(const DataView& testData, int* predictions)
+    {
+        predict(testData, predictions);
+        
+        //record splits of followed sample in each tree
         _sampleStore.clear();
+        if (_followSampleIndex >= 0 && _followSampleIndex < testData.rows()) {
+            
+            DecisionPaths paths;
+            DataView sample(testData.row(_followSampleIndex), 1, testData.cols(), 0, testData.colStride());
+            extractDecisionPaths(sample, paths);
+            
+            vector<const Node*> trees = getTrees();
+            SplitVector& splits = _sampleStore[_followSampleIndex];
+            for (int t=0; t<paths.nTrees; t++) {
+                SplitVector s = getPathSplits(paths, 0, t, trees[t]);
+                splits.insert(splits.end(), s.begin(), s.end());
+            }
+        }
+    }
+    
+    //const prediction: doesn't modify the model, so any number of threads can
+    //  call it at once on a trained model
+    void DecisionTree::predict(const Matrix& testData, vector<int>& predictions) const
+    {
+        predictions.resize(testData.size());
+        predict(DataView(testData), predictions.empty() ? NULL : &predictions[0]);
+    }
+    
+    //const prediction for each row of a data view, one label per row written to
+    //  predictions (read straight from the view's memory)
+    void DecisionTree::predict(const DataView& testData, int* predictions) const
+    {
+        //make prediction for each sample in data view
+        for (int i=0; i<testData.rows(); i++) {
+            predictions[i] = predictSample(_root, testData.row(i), testData.colStride());
+        }
+    }
+    
+    //follows sample (feature f at sample[f*stride]) down the tree starting at
+    //  root, returns label of leaf reached
+    int DecisionTree::predictSample(const Node* root, const int* sample, long stride) const
+    {
+        if (root == NULL) {
+            return _defaultLabel;
+        }
         
-        //make prediction for each sample in data matrix
-        for (unsigned int i=0; i<testData.size(); i++) {
+        //go down tree until we end up at leaf node
+        while (!root->isLeaf) {
             
-            //set prediction to default value to start
-            int prediction = _defaultLabel;    
+            //see which child this data point goes to
+            root = root->chld[(sample[root->spltRule.first*stride] < root->spltRule.second) ? 0 : 1];
             
-            Node* root = _root;
+            if (root == NULL) {
+                return _defaultLabel;
+            }
+        }
+        
+        //make prediction based on label of node
+        return root->lab;
+    }
+    
+    //gets ids of the nodes each sample visits in each tree (root to leaf; empty
+    //  nodes are left out); const, so safe to call from many threads at once
+    void DecisionTree::extractDecisionPaths(const Matrix& testData, DecisionPaths& paths) const
+    {
+        extractDecisionPaths(DataView(testData), paths);
+    }
+    
+    //gets decision paths of each row of a data view
+    void DecisionTree::extractDecisionPaths(const DataView& testData, DecisionPaths& paths) const
+    {
+        vector<const Node*> trees = getTrees();
+        long stride = testData.colStride();
+        
+        paths.nTrees = trees.size();
+        paths.offsets.resize(testData.rows()*trees.size() + 1);
+        paths.offsets[0] = 0;
+        paths.nodeIds.clear();
+        
+        int k = 1;
+        for (int i=0; i<testData.rows(); i++) {
+            const int* sample = testData.row(i);
             
-            //go down tree until we end up at leaf node
-            while (!root->isLeaf) {
-                
-                //get splitting feature index and corresp threshold for this node
-                int featIndex = root->spltRule.first;
-                int threshold = root->spltRule.second;
-                
-                //see which child this data point goes to
-                if (testData[i][featIndex] < threshold) {
-                    
-                    //if set, save split info
-                    if (i == _followSampleIndex) {
-                        saveSplitInfo(i, featIndex, threshold, 0);
-                    }
-                    root = root->chld[0];
-                    
-                } else {
-                    
-                    //if set, save split info
-                    if (i == _followSampleIndex) {
-                        saveSplitInfo(i, featIndex, threshold, 1);
-                    }
-                    root = root->chld[1];
-                }
+            for (unsigned int t=0; t<trees.size(); t++) {
                 
-                if (root == NULL) {
-                    prediction = _defaultLabel;        
-                    break;
+                //go down tree, storing id of each node visited
+                const Node* n = trees[t];
+                while (n != NULL) {
+                    paths.nodeIds.push_back(n->id);
+                    if (n->isLeaf) break;
+                    n = n->chld[(sample[n->spltRule.first*stride] < n->spltRule.second) ? 0 : 1];
                 }
-                
-                //make prediction based on label of node
-                prediction = root->lab;         
+                paths.offsets[k++] = paths.nodeIds.size();
             }
-            
-            //store prediction for sample
-            predictions[i] = prediction;
         }
     }
     
-    //if set, save split info for the selected sample
-    void DecisionTree::saveSplitInfo(int i, int f, int t, int n)
+    //returns feature, threshold and child (0 left, 1 right) of each split on the
+    //  path of sample i through tree t
+    DecisionTree::SplitVector DecisionTree::getPathSplits(const DecisionPaths& paths, int i, int t) const
     {
-        DecisionTree::SplitPair p;
-        vector<int> v;
-        
-        //put info in pair structure
-        p.first = _features[f];
-        v.push_back(t);
-        v.push_back(n);
-        p.second = v;
-        
-        //store feature, threshold, and left/right child node info for sample i
-        _sampleStore[i].push_back(p);
+        return getPathSplits(paths, i, t, getTrees()[t]);
+    }
+    
+    //same as above, given root of tree t (so callers walking every tree fetch roots once)
+    DecisionTree::SplitVector DecisionTree::getPathSplits(const DecisionPaths& paths, int i, int t, const Node* root) const
+    {
+        SplitVector splits;
+        const Node* n = root;
+        int begin = paths.offsets[i*paths.nTrees + t];
+        int end = paths.offsets[i*paths.nTrees + t + 1];
         
-        //clear data structures
-        v.clear();
+        //next node id on path tells which child was taken; a path ending at a
+        //  split node went into an empty (NULL) child, which has no id
+        for (int k=begin; k<end && !n->isLeaf; k++) {
+            int c;
+            if (k+1 < end) {
+                c = (n->chld[0] != NULL && n->chld[0]->id == paths.nodeIds[k+1]) ? 0 : 1;
+            } else {
+                c = (n->chld[0] == NULL) ? 0 : 1;
+            }
+            
+            vector<int> v;
+            v.push_back(n->spltRule.second);
+            v.push_back(c);
+            splits.push_back(SplitPair(_features[n->spltRule.first], v));
+            
+            n = n->chld[c];
+        }
+        return splits;
+    }
+    
+    //gives each node in tree its pre-order index, starting at id
+    void DecisionTree::numberNodes(Node* n, int& id)
+    {
+        if (n == NULL) return;
+        n->id = id++;
+        for (unsigned int i=0; i<n->chld.size(); i++) {
+            numberNodes(n->chld[i], id);
+        }
+    }
+    
+    //returns number of features the model expects in each sample
+    int DecisionTree::getNumFeatures() const
+    {
+        return _nFeatures;
+    }
+    
+    //returns names of features
+    const vector<string>& DecisionTree::getFeatures() const
+    {
+        return _features;
+    }
+    
+    //returns label predicted when a sample reaches an empty node
+    int DecisionTree::getDefaultLabel() const
+    {
+        return _defaultLabel;
+    }
+    
+    //returns root of each tree in the model (just one for a decision tree)
+    vector<const DecisionTree::Node*> DecisionTree::getTrees() const
+    {
+        return vector<const Node*>(1, _root);
     }
     
     //returns saved split info for selected data point index s
@@ -276,44 +972,60 @@ namespace trees
         return ((double)accurate)/((double)pSize);
     }
     
-    //recursive function to construct decision tree
-    DecisionTree::Node* DecisionTree::buildDecisionTree(Matrix& trainData, vector<int>& trainLabels, Node* n)
+    //recursive function to construct decision tree from the rows of data in samples
+    DecisionTree::Node* DecisionTree::buildDecisionTree(const DataView& trainData, const int* trainLabels,
+                                                        vector<int>& labelIndex, vector<int>& samples, Node* n, int depth)
     {
+        vector<int> nodeLabels = getSampleLabels(trainLabels, samples);
+        n->lab = getLabelMode(nodeLabels);
         
-        n->lab = getLabelMode(trainLabels);
-        
-        //return NULL if table has no data in it
-        if (trainData.size() == 0) {
+        //return NULL if node has no data in it
+        if (samples.size() == 0) {
             return NULL;
         }
         
+        //if cancelled or out of budget, node stays a leaf
+        if (checkTrainingBudgets(1)) {
+            n->isLeaf = true;
+            return n;
+        }
+        
         //if all samples in the node have the same label, stop and label node
-        if (sameLabels(trainLabels)) {
+        if (sameLabels(nodeLabels)) {
             
             //current node is a leaf node, assign label
             n->isLeaf = true;
-            n->lab = trainLabels[0];
+            n->lab = nodeLabels[0];
+            return n;
+            
+        //if max depth reached, stop and assign leaf node
+        } else if (_maxDepth >= 0 && depth >= _maxDepth) {
+            
+            n->isLeaf = true;
             return n;
             
         //decide splitting column and branch off
         } else {
             
             //use split feature/threshold rule with maximum info gain
-            n->spltRule = findSegmentor(trainData, trainLabels);
+            n->spltRule = findSegmentor(trainData, trainLabels, labelIndex, samples);
+            
+            //no admissible split (extra-trees), stop and assign leaf node
+            if (n->spltRule.first < 0) {
+                n->isLeaf = true;
+                return n;
+            }
             
-            //stores subsets of data in each child node (2 b/c binary)
-            vector< Matrix > tData(2, Matrix(0));
-            vector< vector<int> > tLabels(2, vector<int>(0));
+            //samples in each child node (2 b/c binary)
+            vector<int> tSamples[2];
+            partitionSamples(trainData, n, samples, tSamples[0], tSamples[1]);
             
-            //get subset of data in each child node, check for min node size
+            //check for min node size
             for (unsigned int i=0; i<2; i++) {
                 
-                trimMatrix(trainData, trainLabels, tData[i], tLabels[i], n->spltRule, i);
-                
                 //if reached minimum node size, stop and assign leaf node
-                if (tData[i].size() < _minNodeSize) {
+                if (tSamples[i].size() < _minNodeSize) {
                     n->isLeaf = true;
-                    n->lab = getLabelMode(trainLabels);
                     return n;
                 }
             }
@@ -321,7 +1033,7 @@ namespace trees
             //if both proposed children have enough samples in each, proceed
             if (_vocal) {
                 cout << "feature: " << _features[n->spltRule.first] << "\tthreshold: " << n->spltRule.second << endl;
-                cout << "\tsize left node: " << tData[0].size() << "\tsize right node: " << tData[1].size() << endl;
+                cout << "\tsize left node: " << tSamples[0].size() << "\tsize right node: " << tSamples[1].size() << endl;
             }
             
             //make new child nodes and recursively build tree
@@ -330,48 +1042,245 @@ namespace trees
                 Node* n2 = (Node*) new DecisionTree::Node(2);
                 n2->lab = _defaultLabel;
                 
-                n->chld.push_back(buildDecisionTree(tData[i], tLabels[i], n2));
+                n->chld.push_back(buildDecisionTree(trainData, trainLabels, labelIndex, tSamples[i], n2, depth+1));
             }
         }
         return n;
     }
     
-    //trims table to include only data that belongs in the node
-    void DecisionTree::trimMatrix(Matrix& data, vector<int>& labels, Matrix& tData,
-                                  vector<int>& tLabels, pair<int, int>& seg, int nodeIndex)
+    //grows tree level-wise or best-first (largest gain first) within depth/leaf budgets
+    //  (labelIndex maps each training row to its label's index in _labelValues)
+    void DecisionTree::growTree(const DataView& trainData, vector<int>& labelIndex, vector<int>& samples, Node* root)
     {
-        //iterate through samples
-        for (unsigned int i=0; i<data.size(); i++) {
+        int nLabels = _labelValues.size();
+        
+        //start with all samples in the root node
+        vector<GrowthCandidate> batch(1);
+        batch[0].node = root;
+        batch[0].depth = 0;
+        batch[0].samples = samples;
+        checkTrainingBudgets(1);
+        
+        int nLeaves = 1;
+        
+        //level-wise: gather statistics for the whole level, then expand it
+        if (_growthMode == LEVEL_WISE) {
+            
+            while (!batch.empty()) {
+                
+                evaluateCandidates(trainData, labelIndex, nLabels, batch);
+                
+                vector<GrowthCandidate> nextLevel;
+                for (unsigned int i=0; i<batch.size(); i++) {
+                    
+                    //each split turns one leaf into two (none once cancelled or out of budget)
+                    if (batch[i].splittable && (_maxLeaves < 0 || nLeaves < _maxLeaves) && !checkTrainingBudgets(2)) {
+                        splitCandidate(trainData, batch[i], nextLevel);
+                        nLeaves++;
+                    } else {
+                        batch[i].node->isLeaf = true;
+                    }
+                }
+                batch.swap(nextLevel);
+            }
+            
+        //best-first: always expand the node whose split has largest gain
+        } else {
+            
+            vector<GrowthCandidate> pool;
+            priority_queue< pair<double, int> > queue;
+            
+            while (!batch.empty()) {
+                
+                evaluateCandidates(trainData, labelIndex, nLabels, batch);
+                
+                //queue splittable nodes (ties go to the earliest node)
+                for (unsigned int i=0; i<batch.size(); i++) {
+                    if (batch[i].splittable) {
+                        queue.push(make_pair(batch[i].gain, -((int)pool.size())));
+                        pool.push_back(GrowthCandidate());
+                        swap(pool.back(), batch[i]);
+                    } else {
+                        batch[i].node->isLeaf = true;
+                    }
+                }
+                batch.clear();
+                
+                if (queue.empty()) break;
+                
+                GrowthCandidate& c = pool[-queue.top().second];
+                queue.pop();
+                
+                //once leaf budget is spent (or training is stopped), remaining nodes stay leaves
+                if ((_maxLeaves >= 0 && nLeaves >= _maxLeaves) || checkTrainingBudgets(2)) {
+                    c.node->isLeaf = true;
+                    while (!queue.empty()) {
+                        pool[-queue.top().second].node->isLeaf = true;
+                        queue.pop();
+                    }
+                    break;
+                }
+                splitCandidate(trainData, c, batch);
+                nLeaves++;
+            }
+        }
+    }
+    
+    //finds label of each candidate node and best split for it
+    void DecisionTree::evaluateCandidates(const DataView& data, vector<int>& labelIndex, int nLabels, vector<GrowthCandidate>& batch)
+    {
+        //sketched thresholds of each feature, as sorted vectors for binning
+        vector< vector<int> > cuts;
+        if (_sketchThresholds > 0 && !_randomThresholds) {
+            cuts.resize(_nFeatures);
+            for (int f=0; f<_nFeatures; f++) {
+                cuts[f].assign(_featureValues[f].begin(), _featureValues[f].end());
+            }
+        }
+        
+        for (unsigned int c=0; c<batch.size(); c++) {
+            
+            GrowthCandidate& cand = batch[c];
+            vector<int>& samples = cand.samples;
+            cand.splittable = false;
+            cand.gain = 0.0;
             
-            //if dealing with left child
-            if (nodeIndex == 0) {
+            //label counts for node, node label is the mode
+            vector<int> counts(nLabels, 0);
+            for (unsigned int i=0; i<samples.size(); i++) {
+                counts[labelIndex[samples[i]]]++;
+            }
+            int best = 0;
+            for (int l=1; l<nLabels; l++) {
+                if (counts[l] > counts[best]) best = l;
+            }
+            list<int>::iterator lit = _labelValues.begin();
+            advance(lit, best);
+            cand.node->lab = *lit;
+            
+            //stop if node is pure or at max depth
+            if (counts[best] == (int)samples.size()) continue;
+            if (_maxDepth >= 0 && cand.depth >= _maxDepth) continue;
+            
+            vector<int> featureIndices = chooseFeatures();
+            int n = samples.size();
+            double parentEntropy = countEntropy(counts, n);
+            
+            //extra-trees: best of one random threshold per feature
+            if (_randomThresholds) {
+                double minEntropy = parentEntropy;
+                cand.splittable = findRandomSplit(data, labelIndex, nLabels, samples, featureIndices, cand.spltRule, minEntropy);
+                cand.gain = n*(parentEntropy - minEntropy);
+                continue;
+            }
+            
+            //one pass over the node's samples: per-feature histograms of value (or
+            //  threshold bin) -> label counts
+            vector< map<int, vector<int> > > hist(featureIndices.size());
+            long stride = data.colStride();
+            for (unsigned int i=0; i<samples.size(); i++) {
+                
+                const int* row = data.row(samples[i]);
+                int lab = labelIndex[samples[i]];
                 
-                //if value of splitting feature less than threshold, belongs in node
-                if (data[i][seg.first] < seg.second) {
+                for (unsigned int f=0; f<featureIndices.size(); f++) {
+                    int v = row[featureIndices[f]*stride];
                     
-                    //store data point and label info
-                    tData.push_back(data[i]);
-                    tLabels.push_back(labels[i]);
+                    //sketched thresholds: value falls in the bin of the largest threshold <= value
+                    if (!cuts.empty()) {
+                        const vector<int>& t = cuts[featureIndices[f]];
+                        int b = upper_bound(t.begin(), t.end(), v) - t.begin();
+                        v = (b == 0) ? INT_MIN : t[b-1];
+                    }
+                    
+                    vector<int>& h = hist[f][v];
+                    if (h.empty()) h.resize(nLabels, 0);
+                    h[lab]++;
                 }
             }
             
-            //if dealing with right child
-            else {
+            //sweep observed values in order; threshold at each value after the first
+            double minEntropy = parentEntropy;
+            int bestLeft = 0;
+            for (unsigned int f=0; f<featureIndices.size(); f++) {
                 
-                //if value of splitting feature geq than threshold, belongs in node
-                if (data[i][seg.first] >= seg.second) {
+                vector<int> left(nLabels, 0);
+                vector<int> right = counts;
+                int nLeft = 0;
+                
+                map<int, vector<int> >::iterator it = hist[f].begin();
+                for (; it != hist[f].end(); ++it) {
                     
-                    //store data point and label info
-                    tData.push_back(data[i]);
-                    tLabels.push_back(labels[i]);
+                    //split [ , t) & [t, ] with t the current value
+                    if (nLeft > 0) {
+                        
+                        double entropy = (nLeft*countEntropy(left, nLeft) + (n-nLeft)*countEntropy(right, n-nLeft))/n;
+                        if (!cand.splittable || entropy < minEntropy) {
+                            cand.splittable = true;
+                            cand.spltRule = make_pair(featureIndices[f], it->first);
+                            minEntropy = entropy;
+                            bestLeft = nLeft;
+                        }
+                    }
+                    
+                    //move samples with this value to the left side
+                    for (int l=0; l<nLabels; l++) {
+                        left[l] += it->second[l];
+                        right[l] -= it->second[l];
+                        nLeft += it->second[l];
+                    }
                 }
             }
+            
+            //as in depth-first growth, node stays a leaf if the best split
+            //  leaves either child with fewer than min node size samples
+            if (bestLeft < _minNodeSize || n - bestLeft < _minNodeSize) {
+                cand.splittable = false;
+            }
+            cand.gain = n*(parentEntropy - minEntropy);
+        }
+    }
+    
+    //splits candidate node with its best split, appends children to batch
+    void DecisionTree::splitCandidate(const DataView& data, GrowthCandidate& cand, vector<GrowthCandidate>& batch)
+    {
+        Node* n = cand.node;
+        n->spltRule = cand.spltRule;
+        n->isLeaf = false;
+        
+        //make new child nodes, send each sample to the side it falls on
+        GrowthCandidate chld[2];
+        for (unsigned int i=0; i<2; i++) {
+            chld[i].node = (Node*) new DecisionTree::Node(2);
+            chld[i].node->lab = _defaultLabel;
+            chld[i].depth = cand.depth + 1;
+            n->chld.push_back(chld[i].node);
+        }
+        for (unsigned int i=0; i<cand.samples.size(); i++) {
+            int s = cand.samples[i];
+            chld[data(s, n->spltRule.first) < n->spltRule.second ? 0 : 1].samples.push_back(s);
+        }
+        
+        if (_vocal) {
+            cout << "feature: " << _features[n->spltRule.first] << "\tthreshold: " << n->spltRule.second << endl;
+            cout << "\tsize left node: " << chld[0].samples.size() << "\tsize right node: " << chld[1].samples.size() << endl;
+        }
+        
+        //parent's samples no longer needed
+        vector<int>().swap(cand.samples);
+        
+        for (unsigned int i=0; i<2; i++) {
+            batch.push_back(GrowthCandidate());
+            swap(batch.back(), chld[i]);
         }
     }
     
     //*** can optimize further by sorting points based on feature val, not using linked lists
     //returns feature index and threshold for best split for data in single node
-    pair<int, int> DecisionTree::findSegmentor(Matrix& data, vector<int>& labels)
+    //  (feature index -1 if there is no admissible split)
+    //  (labelIndex maps each training row to its label's index in _labelValues)
+    pair<int, int> DecisionTree::findSegmentor(const DataView& data, const int* labels, vector<int>& labelIndex,
+                                               vector<int>& samples)
     {
         double entropy = 0.0;
         double minEntropy = 10.0;
@@ -381,20 +1290,15 @@ namespace trees
         
         
         //either check all features or a randomly selected subset
-        std::vector<int> featureIndices;
-        if (_nConsideredFeatures == _nFeatures) {
-            
-            //include all features (all indices)
-            for (int i=0; i<_nFeatures; i++) {
-                featureIndices.push_back(i);
-            }
-        } else {
-            
-            //randomly choose subset of feature indices
-            srand (time(NULL));
-            for (int i=0; i<_nConsideredFeatures; i++) {
-                featureIndices.push_back(rand() % _nFeatures);
+        std::vector<int> featureIndices = chooseFeatures();
+        
+        //extra-trees: best of one random threshold per feature (feature -1 if
+        //  no feature can be split)
+        if (_randomThresholds) {
+            if (!findRandomSplit(data, labelIndex, _labelValues.size(), samples, featureIndices, p, minEntropy)) {
+                p = make_pair(-1, 0);
             }
+            return p;
         }
     
         
@@ -405,19 +1309,20 @@ namespace trees
             
             
             //check for simple case of only two feature values (e.g. 0's and 1's), not split yet
-            if (_featureValues[m].size() == 2) {
+            //  (sketched thresholds needn't be all of the values)
+            if (_featureValues[m].size() == 2 && _sketchThresholds == 0) {
                 
                 leftLabStore.clear();
                 rightLabStore.clear();
                 
                 //iterate through samples and check labels
-                for (unsigned int k=0; k<data.size(); k++) {
+                for (unsigned int k=0; k<samples.size(); k++) {
                     
                     //just split into two based on value
-                    if (data[k][m] == _featureValues[m].front()) {
-                        leftLabStore.push_back(labels[k]);
+                    if (data(samples[k], m) == _featureValues[m].front()) {
+                        leftLabStore.push_back(labels[samples[k]]);
                     } else {
-                        rightLabStore.push_back(labels[k]);
+                        rightLabStore.push_back(labels[samples[k]]);
                     }
                 }
                 //calculate entropy associated with split, store with feature and threshold
@@ -436,7 +1341,7 @@ namespace trees
                 
             //if more than two possible labels, have to iterate through possible splits
             }
-            else if (_featureValues[m].size() > 2) {
+            else if (_featureValues[m].size() > 2 || _sketchThresholds > 0) {
             
                 //iterate through all possible splits betwee observed values
                 for (it = _featureValues[m].begin(); it != _featureValues[m].end(); ++it) {
@@ -445,13 +1350,13 @@ namespace trees
                     rightLabStore.clear();
                 
                     //iterate through samples and collect labels on either size of threshold
-                    for (unsigned int k=0; k<data.size(); k++) {
+                    for (unsigned int k=0; k<samples.size(); k++) {
                     
                         //check threshold: greater than / eq to j, less than j (binary splits)
-                        if (data[k][m] < *it) {
-                            leftLabStore.push_back(labels[k]);
+                        if (data(samples[k], m) < *it) {
+                            leftLabStore.push_back(labels[samples[k]]);
                         } else {
-                            rightLabStore.push_back(labels[k]);
+                            rightLabStore.push_back(labels[samples[k]]);
                         }
                     }
                 
@@ -474,6 +1379,108 @@ namespace trees
         return p;
     }
     
+    //returns random integer in [0, n) from the model's own generator
+    int DecisionTree::randomInt(int n)
+    {
+        return rand_r(&_randState) % n;
+    }
+    
+    //returns random integer in [0, n) for ranges that may not fit in an int
+    //  (same draws as randomInt when they do)
+    long long DecisionTree::randomLong(long long n)
+    {
+        if (n <= RAND_MAX) return randomInt((int)n);
+        long long r = rand_r(&_randState);
+        r = (r << 31) | rand_r(&_randState);
+        return r % n;
+    }
+    
+    //returns indices of features to consider at a node (all, or a random subset)
+    vector<int> DecisionTree::chooseFeatures()
+    {
+        vector<int> featureIndices;
+        if (_nConsideredFeatures == _nFeatures) {
+            
+            //include all features (all indices)
+            for (int i=0; i<_nFeatures; i++) {
+                featureIndices.push_back(i);
+            }
+        } else {
+            
+            //randomly choose subset of feature indices
+            for (int i=0; i<_nConsideredFeatures; i++) {
+                featureIndices.push_back(randomInt(_nFeatures));
+            }
+        }
+        return featureIndices;
+    }
+    
+    //calculates shannon entropy of a histogram of label counts (n samples total)
+    double DecisionTree::countEntropy(vector<int>& counts, int n)
+    {
+        double entropy = 0.0;
+        double invN = 1.0/((double)n);
+        for (unsigned int i=0; i<counts.size(); i++) {
+            if (counts[i] > 0) {
+                double p = counts[i]*invN;
+                entropy -= p*log2(p);
+            }
+        }
+        return entropy;
+    }
+    
+    //extra-trees split: draws one threshold per feature uniformly within the range of the
+    //  node's values and keeps the one with lowest entropy if below minEntropy;
+    //  returns false if no feature has an admissible split (O(n) per feature, no sort)
+    bool DecisionTree::findRandomSplit(const DataView& data, vector<int>& labelIndex, int nLabels, vector<int>& samples,
+                                       vector<int>& featureIndices, pair<int, int>& rule, double& minEntropy)
+    {
+        int n = samples.size();
+        bool found = false;
+        vector<int> left(nLabels), right(nLabels);
+        
+        for (unsigned int f=0; f<featureIndices.size(); f++) {
+            
+            int m = featureIndices[f];
+            
+            //range of feature values in node
+            int lo = data(samples[0], m);
+            int hi = lo;
+            for (int i=1; i<n; i++) {
+                int v = data(samples[i], m);
+                if (v < lo) lo = v;
+                if (v > hi) hi = v;
+            }
+            if (lo == hi) continue;
+            
+            //threshold in (lo, hi] so neither side is empty (range is computed
+            //  in long long, it overflows an int for widely spread values)
+            int t = (int)(lo + 1 + randomLong((long long)hi - lo));
+            
+            //label counts on either side of threshold
+            fill(left.begin(), left.end(), 0);
+            fill(right.begin(), right.end(), 0);
+            int nLeft = 0;
+            for (int i=0; i<n; i++) {
+                if (data(samples[i], m) < t) {
+                    left[labelIndex[samples[i]]]++;
+                    nLeft++;
+                } else {
+                    right[labelIndex[samples[i]]]++;
+                }
+            }
+            if (nLeft < _minNodeSize || n - nLeft < _minNodeSize) continue;
+            
+            double entropy = (nLeft*countEntropy(left, nLeft) + (n-nLeft)*countEntropy(right, n-nLeft))/n;
+            if (!found || entropy < minEntropy) {
+                found = true;
+                rule = make_pair(m, t);
+                minEntropy = entropy;
+            }
+        }
+        return found;
+    }
+    
     //calculates shannon entropy associated with a given split
     double DecisionTree::calculateEntropy(list<int>& l, list<int>& r)
     {
@@ -512,30 +1519,12 @@ namespace trees
         return entropy;
     }
     
-    //randomizes samples+labels
-    void DecisionTree::randomizeSamples(Matrix& data, std::vector<int>& labels)
+    //randomizes order of sample indices
+    void DecisionTree::randomizeSamples(vector<int>& samples)
     {
-        Matrix data2;
-        vector<int> labels2;
-        srand(time(NULL));
-        
-        //choose random indices and add to new data structures
-        for (unsigned int i=0; i<data.size(); i++) {
-            
-            int randNum = rand() % data.size();
-            
-            data2.push_back(data[randNum]);
-            labels2.push_back(labels[randNum]);
-            
-            data.erase(data.begin() + randNum);
-            labels.erase(labels.begin() + randNum);
+        for (int i=samples.size()-1; i>0; i--) {
+            swap(samples[i], samples[randomInt(i+1)]);
         }
-        
-        //assign to original data structures
-        data = data2;
-        labels = labels2;
-        data2.clear();
-        labels2.clear();
     }
     
     //returns true if all samples in node have same label
@@ -570,28 +1559,48 @@ namespace trees
         }
     }
     
-    //makes list of possible label values (assumes integers)
-    list<int> DecisionTree::getLabelValues(vector<int>& labels)
+    //makes list of possible label values of the given samples (assumes integers)
+    list<int> DecisionTree::getLabelValues(const int* labels, vector<int>& samples)
     {
         list<int> l;
         
-        //iterate through labels to find unique values
-        for (unsigned int i=0; i<labels.size(); i++) {
-            l.push_back(labels[i]);
-            if (l.size() > 1) {
-                l.sort();
-                l.unique();
-            }
+        //collect labels, keep unique values
+        for (unsigned int i=0; i<samples.size(); i++) {
+            l.push_back(labels[samples[i]]);
+        }
+        l.sort();
+        l.unique();
+        return l;
+    }
+    
+    //maps label of each sample (by row of data) to its index in _labelValues
+    vector<int> DecisionTree::getLabelIndex(const DataView& data, const int* labels, vector<int>& samples)
+    {
+        vector<int> labelVals(_labelValues.begin(), _labelValues.end());
+        vector<int> labelIndex(data.rows());
+        for (unsigned int i=0; i<samples.size(); i++) {
+            int s = samples[i];
+            labelIndex[s] = lower_bound(labelVals.begin(), labelVals.end(), labels[s]) - labelVals.begin();
+        }
+        return labelIndex;
+    }
+    
+    //returns labels of the given samples
+    vector<int> DecisionTree::getSampleLabels(const int* labels, vector<int>& samples)
+    {
+        vector<int> l(samples.size());
+        for (unsigned int i=0; i<samples.size(); i++) {
+            l[i] = labels[samples[i]];
         }
         return l;
     }
     
     //returns most probable label to use as default label
-    int DecisionTree::getLabelMode(vector<int>& labels)
+    int DecisionTree::getLabelMode(const vector<int>& labels) const
     {
         map<int, int> count;
         map<int, int>::iterator mapit;
-        list<int>::iterator it;
+        list<int>::const_iterator it;
         
         //iterate through each possible label
         for (it = _labelValues.begin(); it != _labelValues.end(); ++it) {
@@ -617,10 +1626,31 @@ namespace trees
         return d;
     }
     
-    //makes list of values for each feature
-    vector< list<int> > DecisionTree::getFeatureValues(Matrix& data)
+    //makes list of candidate thresholds for each feature: quantiles from a
+    //  sketch of each feature, built in one pass over the samples
+    vector< list<int> > DecisionTree::getSketchThresholds(const DataView& data, vector<int>& samples)
+    {
+        vector<QuantileSketch> sketches(_nFeatures, QuantileSketch(_sketchSize));
+        long stride = data.colStride();
+        
+        for (unsigned int j=0; j<samples.size(); j++) {
+            const int* row = data.row(samples[j]);
+            for (int i=0; i<_nFeatures; i++) {
+                sketches[i].insert(row[i*stride]);
+            }
+        }
+        
+        vector< list<int> > info(_nFeatures);
+        for (int i=0; i<_nFeatures; i++) {
+            vector<int> t = sketches[i].getThresholds(_sketchThresholds);
+            info[i].assign(t.begin(), t.end());
+        }
+        return info;
+    }
+    
+    //makes list of values of the given samples for each feature
+    vector< list<int> > DecisionTree::getFeatureValues(const DataView& data, vector<int>& samples)
     {
-        Matrix::iterator it;
         list<int> vals;
         vector< list<int> > info;
         
@@ -628,10 +1658,10 @@ namespace trees
         for (unsigned int i=0; i<_nFeatures; i++) {
             
             //iterate through all samples
-            for (unsigned int j=0; j<data.size(); j++) {
+            for (unsigned int j=0; j<samples.size(); j++) {
                 
                 //store value of "i"th feature for "j"th sample
-                vals.push_back(data[j][i]);
+                vals.push_back(data(samples[j], i));
             }
 
             //store only unique features
@@ -645,5 +1675,165 @@ namespace trees
         vals.clear();
         return info;
     }
+    
+    //frees a tree and all of its nodes
+    void DecisionTree::deleteTree(Node* n)
+    {
+        if (n == NULL) return;
+        for (unsigned int i=0; i<n->chld.size(); i++) {
+            deleteTree(n->chld[i]);
+        }
+        delete n;
+    }
+    
+    //saves trained tree to text file (see writeModelHeader for format)
+    bool DecisionTree::saveModel(const string& fileName) const
+    {
+        ofstream out(fileName.c_str());
+        if (!out) {
+            cerr << "Error: can't open " << fileName << " for writing" << endl;
+            return false;
+        }
+        writeModelHeader(out, 1);
+        writeTree(out, _root);
+        return out.good();
+    }
+    
+    //loads tree saved with saveModel, replacing features and current tree
+    bool DecisionTree::loadModel(const string& fileName)
+    {
+        ifstream in(fileName.c_str());
+        if (!in) {
+            cerr << "Error: can't open " << fileName << endl;
+            return false;
+        }
+        if (readModelHeader(in) != 1) {
+            cerr << "Error: " << fileName << " does not hold a single decision tree" << endl;
+            return false;
+        }
+        bool ok = true;
+        Node* root = readTree(in, ok);
+        if (!ok) {
+            cerr << "Error: corrupt tree in " << fileName << endl;
+            deleteTree(root);
+            return false;
+        }
+        int id = 0;
+        numberNodes(root, id);
+        _root = root;
+        return true;
+    }
+    
+    //writes model header:
+    //  libtrees-model 1
+    //  features <n>, followed by one feature name per line
+    //  labels <# labels> <label values>
+    //  default <default label>
+    //  trees <# trees>, followed by the trees (see writeTree)
+    void DecisionTree::writeModelHeader(ostream& out, int nTrees) const
+    {
+        out << "libtrees-model 1" << endl;
+        out << "features " << _nFeatures << endl;
+        for (int i=0; i<_nFeatures; i++) {
+            out << _features[i] << endl;
+        }
+        out << "labels " << _labelValues.size();
+        for (list<int>::const_iterator it = _labelValues.begin(); it != _labelValues.end(); ++it) {
+            out << " " << *it;
+        }
+        out << endl;
+        out << "default " << _defaultLabel << endl;
+        out << "trees " << nTrees << endl;
+    }
+    
+    //reads model header, sets features and labels; returns # of trees (-1 on error)
+    int DecisionTree::readModelHeader(istream& in)
+    {
+        string tag;
+        int version = 0;
+        int n = 0;
+        
+        in >> tag >> version;
+        if (tag != "libtrees-model" || version != 1) return -1;
+        
+        //feature names, one per line
+        in >> tag >> n;
+        if (tag != "features" || n < 0) return -1;
+        getline(in, tag);
+        vector<string> features(n);
+        for (int i=0; i<n; i++) {
+            getline(in, features[i]);
+        }
+        
+        //label values and default label
+        list<int> labelValues;
+        in >> tag >> n;
+        if (tag != "labels" || n < 0) return -1;
+        for (int i=0; i<n; i++) {
+            int l;
+            in >> l;
+            labelValues.push_back(l);
+        }
+        int defaultLabel;
+        in >> tag >> defaultLabel;
+        if (tag != "default") return -1;
+        
+        int nTrees;
+        in >> tag >> nTrees;
+        if (!in || tag != "trees") return -1;
+        
+        //replace model's features and labels
+        _features = features;
+        _nFeatures = _features.size();
+        _nConsideredFeatures = _nFeatures;
+        _featureMap.clear();
+        makeFeatureIndexMap(_features);
+        _labelValues = labelValues;
+        _defaultLabel = defaultLabel;
+        
+        return nTrees;
+    }
+    
+    //writes tree in pre-order, one node per line:
+    //  S <feature index> <threshold> <label>  for split nodes
+    //  L <label>                              for leaf nodes
+    //  N                                      for empty (NULL) nodes
+    void DecisionTree::writeTree(ostream& out, const Node* n) const
+    {
+        if (n == NULL) {
+            out << "N" << endl;
+        } else if (n->isLeaf) {
+            out << "L " << n->lab << endl;
+        } else {
+            out << "S " << n->spltRule.first << " " << n->spltRule.second << " " << n->lab << endl;
+            writeTree(out, n->chld[0]);
+            writeTree(out, n->chld[1]);
+        }
+    }
+    
+    //reads tree written by writeTree, sets ok to false if malformed
+    DecisionTree::Node* DecisionTree::readTree(istream& in, bool& ok)
+    {
+        string type;
+        if (!ok || !(in >> type) || type == "N") {
+            if (type != "N") ok = false;
+            return NULL;
+        }
+        
+        Node* n = (Node*) new DecisionTree::Node(2);
+        if (type == "L") {
+            n->isLeaf = true;
+            in >> n->lab;
+        } else if (type == "S") {
+            in >> n->spltRule.first >> n->spltRule.second >> n->lab;
+            if (n->spltRule.first < 0 || n->spltRule.first >= _nFeatures) ok = false;
+            for (unsigned int i=0; i<2; i++) {
+                n->chld.push_back(readTree(in, ok));
+            }
+        } else {
+            ok = false;
+        }
+        if (!in) ok = false;
+        return n;
+    }
 }
-
@@ -20,6 +20,8 @@
 #include <vector>
 #include <map>
 #include <list>
+#include <queue>
+#include <pthread.h>
 
 
 
@@ -27,6 +29,8 @@ namespace trees {
     
     class DecisionTree
     {
+        //jobs reserve the model for the run they start on their own thread
+        friend class TrainingJob;
         
     public:
         
@@ -40,6 +44,36 @@ namespace trees {
         typedef std::vector< SplitPair > SplitVector;
         typedef std::map<int, SplitVector> SplitMap;
         
+        //non-owning view of a feature matrix: value (r, c) is data[r*rowStride + c*colStride]
+        //  (row-major: rowStride=cols, colStride=1; column-major: rowStride=1, colStride=rows);
+        //  a view of a Matrix points at its rows, so neither copies feature values
+        class DataView
+        {
+        public:
+            DataView(const int*, int, int, long, long);
+            explicit DataView(const Matrix&);
+            
+            int rows() const { return _rows; }
+            int cols() const { return _cols; }
+            long colStride() const { return _colStride; }
+            const int* row(int r) const { return _rowTable.empty() ? _data + r*_rowStride : _rowTable[r]; }
+            int operator()(int r, int c) const { return row(r)[c*_colStride]; }
+            
+        private:
+            const int* _data;                   //first value (NULL for a view of a Matrix)
+            int _rows;                          //number of samples
+            int _cols;                          //number of features
+            long _rowStride;                    //distance between samples (in ints)
+            long _colStride;                    //distance between features (in ints)
+            std::vector<const int*> _rowTable;  //first value of each row (view of a Matrix only)
+        };
+        
+        //order in which nodes are expanded while growing a tree
+        enum GrowthMode { DEPTH_FIRST, LEVEL_WISE, BEST_FIRST };
+        
+        //why a training run stopped
+        enum StopReason { COMPLETED, CANCELLED, TIME_BUDGET, MEMORY_BUDGET };
+        
         
         //define a node class (for each node in the tree)
         struct Node
@@ -54,16 +88,74 @@ namespace trees {
             std::vector<Node*> chld;        //child nodes
             bool isLeaf;               //tells whether node is leaf node
             int lab;                   //when leaf node, label with which to classifty data points
+            int id;                    //pre-order index of node within its tree
+        };
+        
+        //decision paths for a batch of samples, stored CSR-style: the ids of the nodes
+        //  sample i visits in tree t are nodeIds[offsets[i*nTrees+t] .. offsets[i*nTrees+t+1])
+        struct DecisionPaths
+        {
+            int nTrees;                     //number of trees paths were extracted from
+            std::vector<int> offsets;       //start of each (sample, tree) path in nodeIds
+            std::vector<int> nodeIds;       //pre-order node ids, root first
+        };
+        
+        //one subtree on the cost-complexity pruning path
+        struct PruningStep
+        {
+            double alpha;                   //smallest complexity penalty at which subtree is optimal
+            int nLeaves;                    //number of leaves in subtree
+            double error;                   //misclassification rate of subtree on pruning data
+        };
+        
+        //progress of the current (or last) training run
+        struct TrainingProgress
+        {
+            bool running;                   //true while training
+            int treesDone;                  //# of trees finished (folds for cross-validation)
+            int treesTotal;                 //# of trees (folds) the run will train
+            long nodesBuilt;                //# of nodes in finished trees and the current tree
+            long memoryUsed;                //approximate bytes used by those nodes
+            double elapsed;                 //seconds since run started
+            double eta;                     //estimated seconds left (-1 until a tree is finished)
+            StopReason stopReason;          //COMPLETED unless cancelled or a budget ran out
         };
         
         //functions
         void trainDecisionTree(Matrix&, std::vector<int>&, int=20);
+        void trainDecisionTree(const DataView&, const int*, int=20);
         std::map<int, double> performCrossValidation(Matrix&, std::vector<int>&, std::vector<int>&, int=1, int=10);
+        std::map<int, double> performCrossValidation(const DataView&, const int*, std::vector<int>&, int=1, int=10);
+        std::map<double, double> crossValidatePruning(Matrix&, std::vector<int>&, std::vector<double>&, int=20, int=10);
+        std::map<double, double> crossValidatePruning(const DataView&, const int*, std::vector<double>&, int=20, int=10);
+        std::vector<PruningStep> computePruningPath(Matrix&, std::vector<int>&);
+        virtual int pruneTree(Matrix&, std::vector<int>&, double);
         virtual void makePredictions(Matrix&, std::vector<int>&);
+        void makePredictions(const DataView&, int*);
+        void predict(const Matrix&, std::vector<int>&) const;
+        virtual void predict(const DataView&, int*) const;
+        void extractDecisionPaths(const Matrix&, DecisionPaths&) const;
+        void extractDecisionPaths(const DataView&, DecisionPaths&) const;
+        SplitVector getPathSplits(const DecisionPaths&, int, int) const;
         double computeValidationAccuracy(std::vector<int>&, std::vector<int>&);
         void setVocal(bool);
+        void setGrowthMode(GrowthMode);
+        void setMaxDepth(int);
+        void setMaxLeaves(int);
+        void setQuantileSketch(int, int=200);
+        void setTimeBudget(double);
+        void setMemoryBudget(long);
+        void cancelTraining();
+        TrainingProgress getProgress() const;
+        void setSeed(unsigned int);
         void followSample(int);
         SplitVector getSampleSplits(int);
+        int getNumFeatures() const;
+        const std::vector<std::string>& getFeatures() const;
+        int getDefaultLabel() const;
+        virtual std::vector<const Node*> getTrees() const;
+        virtual bool saveModel(const std::string&) const;
+        virtual bool loadModel(const std::string&);
         
         
         
@@ -82,20 +174,87 @@ namespace trees {
         bool _vocal;                                    //sets whether program prints out info
         int _followSampleIndex;                         //sample index whose splits we record
         SplitMap _sampleStore;                          //stores splits made for selected sample
+        GrowthMode _growthMode;                         //depth-first, level-wise or best-first growth
+        int _maxDepth;                                  //max depth of tree (-1 for no limit)
+        int _maxLeaves;                                 //max # of leaf nodes (-1 for no limit)
+        bool _seedSet;                                  //true if seed was set with setSeed
+        unsigned int _seed;                             //seed set with setSeed
+        unsigned int _randState;                        //state of random number generator
+        bool _randomThresholds;                         //try one random threshold per feature (extra-trees)
+        int _sketchThresholds;                          //max # of sketched thresholds per feature (0: all values)
+        int _sketchSize;                                //size of quantile sketches (larger is more accurate)
+        double _timeBudget;                             //max seconds per training run, -1 for no limit (guarded by _progressMutex)
+        long _memoryBudget;                             //max bytes of nodes per run, -1 for no limit (guarded by _progressMutex)
+        TrainingProgress _progress;                     //progress of current/last run (guarded by _progressMutex)
+        long _treeNodes;                                //# of nodes in current tree (guarded by _progressMutex)
+        bool _cancelRequested;                          //set by cancelTraining (guarded by _progressMutex)
+        bool _trainingPending;                          //a run is about to begin, e.g. on a job's thread (guarded by _progressMutex)
+        double _trainStart;                             //time current run started, monotonic seconds (guarded by _progressMutex)
+        mutable pthread_mutex_t _progressMutex;         //guards progress, lets other threads watch/cancel
+        
+        //node waiting to be expanded during level-wise/best-first growth
+        struct GrowthCandidate
+        {
+            Node* node;
+            std::vector<int> samples;       //indices of training samples that reach node
+            int depth;                      //depth of node (root is 0)
+            bool splittable;                //true if an admissible split was found
+            std::pair<int, int> spltRule;   //best split found for node
+            double gain;                    //entropy reduction of best split (weighted by # samples)
+        };
         
         //functions
         void makeFeatureIndexMap(std::vector<std::string>&);
-        std::list<int> getLabelValues(std::vector<int>&);
-        int getLabelMode(std::vector<int>&);
-        std::vector< std::list<int> > getFeatureValues(Matrix&);
+        std::list<int> getLabelValues(const int*, std::vector<int>&);
+        std::vector<int> getSampleLabels(const int*, std::vector<int>&);
+        std::vector<int> getLabelIndex(const DataView&, const int*, std::vector<int>&);
+        int getLabelMode(const std::vector<int>&) const;
+        std::vector< std::list<int> > getFeatureValues(const DataView&, std::vector<int>&);
+        std::vector< std::list<int> > getSketchThresholds(const DataView&, std::vector<int>&);
         int getFeatureIndex(std::string);
-        Node* buildDecisionTree(Matrix&, std::vector<int>&, Node*);
+        void trainOnSamples(const DataView&, const int*, std::vector<int>&, int);
+        Node* buildDecisionTree(const DataView&, const int*, std::vector<int>&, std::vector<int>&, Node*, int=0);
+        void growTree(const DataView&, std::vector<int>&, std::vector<int>&, Node*);
+        void evaluateCandidates(const DataView&, std::vector<int>&, int, std::vector<GrowthCandidate>&);
+        void splitCandidate(const DataView&, GrowthCandidate&, std::vector<GrowthCandidate>&);
         bool sameLabels(std::vector<int>&);
-        std::pair<int, int> findSegmentor(Matrix&, std::vector<int>&);
+        int randomInt(int);
+        long long randomLong(long long);
+        std::vector<int> chooseFeatures();
+        std::pair<int, int> findSegmentor(const DataView&, const int*, std::vector<int>&, std::vector<int>&);
+        bool findRandomSplit(const DataView&, std::vector<int>&, int, std::vector<int>&, std::vector<int>&, std::pair<int, int>&, double&);
         double calculateEntropy(std::list<int>&, std::list<int>&);
-        void trimMatrix(Matrix&, std::vector<int>&, Matrix&, std::vector<int>&, std::pair<int, int>&, int);
-        void randomizeSamples(Matrix&, std::vector<int>&);
-        void saveSplitInfo(int, int, int, int);
+        double countEntropy(std::vector<int>&, int);
+        void randomizeSamples(std::vector<int>&);
+        void splitFold(std::vector<int>&, int, int, std::vector<int>&, std::vector<int>&);
+        double sampleAccuracy(const DataView&, const int*, std::vector<int>&) const;
+        int countErrors(const int*, std::vector<int>&, int);
+        void partitionSamples(const DataView&, const Node*, std::vector<int>&, std::vector<int>&, std::vector<int>&);
+        std::vector<PruningStep> pruningCost(const Node*, const DataView&, const int*, std::vector<int>&);
+        double pruneSubtree(Node*, const DataView&, const int*, std::vector<int>&, double, int&);
+        int pruneRoot(Node*, const DataView&, const int*, std::vector<int>&, double);
+        void reserveTraining(bool);
+        void beginTraining(int);
+        bool checkTrainingBudgets(int);
+        bool trainingStopped() const;
+        void finishTree(bool);
+        void endTraining();
+        void deleteTree(Node*);
+        void writeModelHeader(std::ostream&, int) const;
+        int readModelHeader(std::istream&);
+        void writeTree(std::ostream&, const Node*) const;
+        Node* readTree(std::istream&, bool&);
+        int predictSample(const Node*, const int*, long) const;
+        SplitVector getPathSplits(const DecisionPaths&, int, int, const Node*) const;
+        void numberNodes(Node*, int&);
+        
+        
+        
+    private:
+        
+        //not copyable (owns a pthread mutex)
+        DecisionTree(const DecisionTree&);
+        DecisionTree& operator=(const DecisionTree&);
     };
 }
 
@@ -0,0 +1,196 @@
+/*
+ *  QuantileSketch.cpp
+ *
+ *  Quantile Sketch: mergeable, fixed-size summary of a stream of integer
+ *      values that answers approximate quantile queries.
+ *
+ *  Method (KLL-style compactors):
+ *      (1) values are added to level 0; a value kept at level h stands for
+ *          2^h of the inserted values
+ *      (2) when a level reaches its capacity it is sorted and every other
+ *          value moves up a level (which half alternates, so errors cancel
+ *          out); levels below the top get geometrically smaller capacities,
+ *          so the sketch keeps O(k log(n/k)) values
+ *      (3) two sketches merge by concatenating their levels and compacting,
+ *          so a data set can be sketched in pieces (in parallel, or one
+ *          shard at a time) and the pieces merged afterwards
+ *      (4) rank error is roughly n/k: larger k is more accurate
+ *
+ *  Compaction is deterministic, so the same input always gives the same
+ *      thresholds.
+ */
+
+
+#include "QuantileSketch.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+
+namespace trees
+{
+    //set size k of top compactor
+    QuantileSketch::QuantileSketch(int k)
+    {
+        _k = (k < 2) ? 2 : k;
+        _n = 0;
+    }
+
+    QuantileSketch::~QuantileSketch()
+    {
+    }
+
+    //returns # of values level h can hold before it is compacted
+    int QuantileSketch::capacity(int h) const
+    {
+        int depth = _levels.size() - 1 - h;
+        int c = (int)ceil(_k*pow(2.0/3.0, depth));
+        return (c < 2) ? 2 : c;
+    }
+
+    //adds value to sketch
+    void QuantileSketch::insert(int v)
+    {
+        if (_levels.empty()) {
+            _levels.push_back(vector<int>());
+            _offsets.push_back(0);
+        }
+        _levels[0].push_back(v);
+        _n++;
+        if ((int)_levels[0].size() >= capacity(0)) {
+            compress();
+        }
+    }
+
+    //adds values summarized by another sketch
+    void QuantileSketch::merge(const QuantileSketch& other)
+    {
+        while (_levels.size() < other._levels.size()) {
+            _levels.push_back(vector<int>());
+            _offsets.push_back(0);
+        }
+        for (unsigned int h=0; h<other._levels.size(); h++) {
+            _levels[h].insert(_levels[h].end(), other._levels[h].begin(), other._levels[h].end());
+        }
+        _n += other._n;
+        compress();
+    }
+
+    //compacts each full level into the one above it, from the bottom up
+    void QuantileSketch::compress()
+    {
+        for (unsigned int h=0; h<_levels.size(); h++) {
+
+            if ((int)_levels[h].size() < capacity(h)) continue;
+
+            if (h+1 == _levels.size()) {
+                _levels.push_back(vector<int>());
+                _offsets.push_back(0);
+            }
+
+            //sort level, hold back one value if odd so pairs stay whole
+            vector<int>& level = _levels[h];
+            sort(level.begin(), level.end());
+            bool odd = (level.size() % 2 == 1);
+            int held = odd ? level.back() : 0;
+            if (odd) level.pop_back();
+
+            //every other value moves up with twice the weight
+            int offset = _offsets[h];
+            _offsets[h] ^= 1;
+            for (unsigned int i=offset; i<level.size(); i+=2) {
+                _levels[h+1].push_back(level[i]);
+            }
+            level.clear();
+            if (odd) level.push_back(held);
+        }
+    }
+
+    //gets retained values with their weights, sorted by value
+    void QuantileSketch::getWeightedValues(vector< pair<int, long> >& values) const
+    {
+        values.clear();
+        for (unsigned int h=0; h<_levels.size(); h++) {
+            for (unsigned int i=0; i<_levels[h].size(); i++) {
+                values.push_back(make_pair(_levels[h][i], ((long)1) << h));
+            }
+        }
+        sort(values.begin(), values.end());
+    }
+
+    //returns approximate q-quantile (0 <= q <= 1) of inserted values
+    int QuantileSketch::quantile(double q) const
+    {
+        vector< pair<int, long> > values;
+        getWeightedValues(values);
+        if (values.empty()) return 0;
+
+        long total = 0;
+        for (unsigned int i=0; i<values.size(); i++) {
+            total += values[i].second;
+        }
+        double target = q*total;
+        long seen = 0;
+        for (unsigned int i=0; i<values.size(); i++) {
+            seen += values[i].second;
+            if (seen >= target) return values[i].first;
+        }
+        return values.back().first;
+    }
+
+    //returns up to m sorted, distinct candidate thresholds: all retained values
+    //  if there are at most m of them, otherwise the m evenly spaced quantiles
+    std::vector<int> QuantileSketch::getThresholds(int m) const
+    {
+        vector< pair<int, long> > values;
+        getWeightedValues(values);
+
+        vector<int> thresholds;
+        for (unsigned int i=0; i<values.size(); i++) {
+            if (thresholds.empty() || thresholds.back() != values[i].first) {
+                thresholds.push_back(values[i].first);
+            }
+        }
+        if ((int)thresholds.size() <= m) return thresholds;
+
+        long total = 0;
+        for (unsigned int i=0; i<values.size(); i++) {
+            total += values[i].second;
+        }
+
+        //value at rank i*total/(m+1) for i = 1..m
+        thresholds.clear();
+        long seen = 0;
+        unsigned int j = 0;
+        for (int i=1; i<=m; i++) {
+            double target = ((double)i)*total/(m+1);
+            while (j < values.size() && seen + values[j].second < target) {
+                seen += values[j].second;
+                j++;
+            }
+            if (j == values.size()) break;
+            if (thresholds.empty() || thresholds.back() != values[j].first) {
+                thresholds.push_back(values[j].first);
+            }
+        }
+        return thresholds;
+    }
+
+    //returns # of values inserted
+    long QuantileSketch::getCount() const
+    {
+        return _n;
+    }
+
+    //returns # of values kept by sketch
+    int QuantileSketch::getNumRetained() const
+    {
+        int n = 0;
+        for (unsigned int h=0; h<_levels.size(); h++) {
+            n += _levels[h].size();
+        }
+        return n;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ *  QuantileSketch.h
+ *
+ *  Quantile Sketch: mergeable, fixed-size summary of a stream of integer
+ *      values (KLL-style compactors) that answers approximate quantile
+ *      queries; used to pick a bounded number of candidate split thresholds
+ *      per feature in one pass over the data.
+ */
+
+#ifndef QuantileSketch_H
+#define QuantileSketch_H
+
+#include <vector>
+
+
+namespace trees {
+
+    class QuantileSketch
+    {
+
+    public:
+
+        //constructor/destructor
+        QuantileSketch(int=200);
+        virtual ~QuantileSketch();
+
+        //functions
+        void insert(int);
+        void merge(const QuantileSketch&);
+        int quantile(double) const;
+        std::vector<int> getThresholds(int) const;
+        long getCount() const;
+        int getNumRetained() const;
+
+
+    protected:
+
+        //global variables
+        int _k;                                     //size of top compactor (larger is more accurate)
+        long _n;                                    //# of values inserted (including merged sketches)
+        std::vector< std::vector<int> > _levels;    //values kept at level h each stand for 2^h values
+        std::vector<char> _offsets;                 //alternates which half of each level is kept
+
+        //functions
+        int capacity(int) const;
+        void compress();
+        void getWeightedValues(std::vector< std::pair<int, long> >&) const;
+    };
+}
+
+#endif
@@ -13,6 +13,22 @@
  *      (5) stops when data in each node has same label or reaches
  *          minimum allowed size (set by user)
  *
+ *  Extra-trees mode:
+ *      each split tries one random threshold per candidate feature (no
+ *      threshold sweep), and by default trees use the full training set
+ *      instead of bootstrap samples
+ *
+ *  Stopping early:
+ *      a run that is cancelled or runs out of its time/memory budget stops
+ *      adding trees; the tree being grown is dropped, so the forest holds
+ *      only whole trees (fewer than asked for)
+ *
+ *  Sharded training:
+ *      tree i is always grown from its own seed, derived from the forest
+ *      seed and i, so a forest can be split into shards of consecutive
+ *      trees that are trained by separate processes (or machines) and
+ *      merged afterwards into the same forest a single process would build
+ *
  *  Created by Kelsey Schuster
  *  11/5/15
  */
@@ -20,6 +36,11 @@
 
 #include "RandomForest.h"
 
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+
 using namespace std;
 
 
@@ -30,6 +51,33 @@ namespace trees
     : DecisionTree(features)
     {
         _storeHeadNodeSplits = false;
+        
+        //train all trees unless a shard is set
+        _shardIndex = 0;
+        _nShards = 1;
+        
+        //bagged trees with exhaustive threshold search by default
+        _bootstrap = true;
+    }
+    
+    //sets extra-trees mode (random thresholds), and whether to still bootstrap
+    void RandomForest::setExtraTrees(bool extra, bool bootstrap)
+    {
+        _randomThresholds = extra;
+        _bootstrap = extra ? bootstrap : true;
+    }
+    
+    //only train shard k of nShards: trees [k*nSamps/nShards, (k+1)*nSamps/nShards);
+    //  returns false (keeping the current shard) unless nShards >= 1 and 0 <= k < nShards
+    bool RandomForest::setShard(int k, int nShards)
+    {
+        if (nShards < 1 || k < 0 || k >= nShards) {
+            cerr << "Error: invalid shard " << k << " of " << nShards << endl;
+            return false;
+        }
+        _shardIndex = k;
+        _nShards = nShards;
+        return true;
     }
     
     //sets whether we're storing splits made at head nodes
@@ -40,6 +88,17 @@ namespace trees
     
     //build random forest by bootstrapping and making multiple trees
     void RandomForest::trainRandomForest(Matrix& trainData, vector<int>& trainLabels, int nSamps, int nFeat, int minSize)
+    {
+        if (trainData.size() != trainLabels.size()) {
+            cerr << "Error: need same number of samples in data and labels" << endl;
+            exit(1);
+        }
+        trainRandomForest(DataView(trainData), trainLabels.empty() ? NULL : &trainLabels[0], nSamps, nFeat, minSize);
+    }
+    
+    //build random forest directly on a data view, one label per row of the view
+    //  (bootstrap samples are sets of row indices, data isn't copied)
+    void RandomForest::trainRandomForest(const DataView& trainData, const int* trainLabels, int nSamps, int nFeat, int minSize)
     {
         _nBootSamps = nSamps;
         _nConsideredFeatures = nFeat;
@@ -47,26 +106,236 @@ namespace trees
         
         _headNodeSplitStore.clear();
         
+        //check to make sure correct # of features
+        if (trainData.rows() == 0 || trainData.cols() != _nFeatures) {
+            cerr << "Error: incorrect number of features" << endl;
+            exit(1);
+        }
+        
+        //trees in this shard, each seeded from forest seed and its index
+        unsigned int seed = _seedSet ? _seed : _randState;
+        int first = (int)(((long)_shardIndex*_nBootSamps)/_nShards);
+        int last = (int)(((long)(_shardIndex+1)*_nBootSamps)/_nShards);
+        
+        //all rows, for trees trained without bootstrapping
+        vector<int> allSamples(trainData.rows());
+        for (int i=0; i<trainData.rows(); i++) {
+            allSamples[i] = i;
+        }
+        
+        //forest's labels and default label come from all training labels, not
+        //  from a tree's bootstrap sample, so they don't depend on the sharding
+        list<int> labelValues = getLabelValues(trainLabels, allSamples);
+        _labelValues = labelValues;
+        int defaultLabel = getLabelMode(getSampleLabels(trainLabels, allSamples));
         
         //make bootstrap samples and train 1 tree for each sample
-        for (unsigned int i=0; i<_nBootSamps; i++) {
+        beginTraining(last - first);
+        for (int i=first; i<last; i++) {
+            
+            //stop adding trees if cancelled or out of budget
+            if (checkTrainingBudgets(0)) break;
             
             if (_vocal) cout << "decision tree " << i << endl;
             
-            //get bootstrap sample
-            Matrix sample;
-            vector<int> sampLabels;
-            getBootstrapSample(trainData, trainLabels, sample, sampLabels);
+            _randState = treeSeed(seed, i);
+            
+            //train decision tree on bootstrap sample (or on all data)
+            if (_bootstrap) {
+                vector<int> sample;
+                getBootstrapSample(trainData.rows(), sample);
+                trainOnSamples(trainData, trainLabels, sample, minSize);
+            } else {
+                trainOnSamples(trainData, trainLabels, allSamples, minSize);
+            }
             
-            //train decision tree
-            DecisionTree::trainDecisionTree(sample, sampLabels, minSize);
+            //drop a tree cut short, forest keeps the finished ones
+            if (trainingStopped()) {
+                deleteTree(_root);
+                finishTree(false);
+                break;
+            }
             _treeStorage.push_back(_root);
+            finishTree(true);
             
             //if set, store head node split
             if (_storeHeadNodeSplits) {
                 storeHeadNodeData();
             }
         }
+        _root = _treeStorage.empty() ? NULL : _treeStorage.back();
+        _labelValues = labelValues;
+        _defaultLabel = defaultLabel;
+        endTraining();
+    }
+    
+    //returns seed for tree i of a forest with given seed (hash mixes bits so
+    //  neighboring trees get unrelated random sequences)
+    unsigned int RandomForest::treeSeed(unsigned int seed, int i)
+    {
+        unsigned int h = seed ^ (0x9e3779b9u*(unsigned int)(i+1));
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+    
+    //trains forest in nProcs forked processes, each training one shard and
+    //  saving it to workDir; the shards are then merged into this forest
+    bool RandomForest::trainRandomForestParallel(Matrix& trainData, vector<int>& trainLabels, int nProcs,
+                                                 const string& workDir, int nSamps, int nFeat, int minSize)
+    {
+        if (trainData.size() != trainLabels.size()) {
+            cerr << "Error: need same number of samples in data and labels" << endl;
+            return false;
+        }
+        return trainRandomForestParallel(DataView(trainData), trainLabels.empty() ? NULL : &trainLabels[0],
+                                         nProcs, workDir, nSamps, nFeat, minSize);
+    }
+    
+    //trains forest in forked processes directly on a data view (children share
+    //  the parent's buffer, nothing is copied)
+    bool RandomForest::trainRandomForestParallel(const DataView& trainData, const int* trainLabels, int nProcs,
+                                                 const string& workDir, int nSamps, int nFeat, int minSize)
+    {
+        //check data before forking, so a child never has to exit() (that would
+        //  run the parent's atexit handlers and flush its stdio buffers again)
+        if (trainData.rows() == 0 || trainData.cols() != _nFeatures) {
+            cerr << "Error: incorrect number of features" << endl;
+            return false;
+        }
+        
+        //all shards must agree on the forest seed
+        if (!_seedSet) setSeed(_randState);
+        
+        //no more processes than trees, so every shard has a tree to train
+        if (nProcs > nSamps) nProcs = nSamps;
+        if (nProcs < 1) nProcs = 1;
+        
+        //children start with empty stdio buffers, so nothing is printed twice
+        fflush(NULL);
+        
+        vector<string> files;
+        vector<pid_t> pids;
+        for (int k=0; k<nProcs; k++) {
+            
+            ostringstream fileName;
+            fileName << workDir << "/shard_" << getpid() << "_" << k << ".model";
+            files.push_back(fileName.str());
+            
+            pid_t pid = fork();
+            if (pid < 0) {
+                cerr << "Error: can't fork shard " << k << endl;
+                break;
+            }
+            
+            //child: train only this shard's trees, save them and exit (with
+            //  _exit, flushing only its own output)
+            if (pid == 0) {
+                _treeStorage.clear();
+                setShard(k, nProcs);
+                trainRandomForest(trainData, trainLabels, nSamps, nFeat, minSize);
+                int status = saveModel(files[k]) ? 0 : 1;
+                fflush(NULL);
+                _exit(status);
+            }
+            pids.push_back(pid);
+        }
+        
+        //wait for all shards
+        bool ok = (pids.size() == (unsigned int)nProcs);
+        for (unsigned int k=0; k<pids.size(); k++) {
+            int status;
+            if (waitpid(pids[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                cerr << "Error: shard " << k << " failed" << endl;
+                ok = false;
+            }
+        }
+        
+        _nBootSamps = nSamps;
+        _nConsideredFeatures = nFeat;
+        _minNodeSize = minSize;
+        if (ok) ok = mergeModels(files);
+        
+        for (unsigned int k=0; k<files.size(); k++) {
+            remove(files[k].c_str());
+        }
+        return ok;
+    }
+    
+    //adds trees of saved models (e.g. shards) to forest in the given order;
+    //  features are matched by name and labels are combined
+    bool RandomForest::mergeModels(const vector<string>& files)
+    {
+        vector<Node*> trees;
+        list<int> labelValues = _labelValues;
+        
+        for (unsigned int f=0; f<files.size(); f++) {
+            
+            vector<string> noFeatures;
+            RandomForest shard(noFeatures);
+            if (!shard.loadModel(files[f])) {
+                for (unsigned int t=0; t<trees.size(); t++) deleteTree(trees[t]);
+                return false;
+            }
+            
+            //empty forest takes features and default label of first model
+            if (_nFeatures == 0 && f == 0) {
+                _features = shard._features;
+                _nFeatures = _features.size();
+                _nConsideredFeatures = _nFeatures;
+                makeFeatureIndexMap(_features);
+            }
+            if (_treeStorage.size() == 0 && trees.size() == 0 && shard._treeStorage.size() > 0) {
+                _defaultLabel = shard._defaultLabel;
+            }
+            
+            //index of each of the shard's features in this forest
+            vector<int> featureIndex(shard._nFeatures);
+            for (int i=0; i<shard._nFeatures; i++) {
+                map<string, int>::iterator it = _featureMap.find(shard._features[i]);
+                if (it == _featureMap.end()) {
+                    cerr << "Error: feature " << shard._features[i] << " in " << files[f] << " not in forest" << endl;
+                    for (unsigned int t=0; t<shard._treeStorage.size(); t++) deleteTree(shard._treeStorage[t]);
+                    for (unsigned int t=0; t<trees.size(); t++) deleteTree(trees[t]);
+                    return false;
+                }
+                featureIndex[i] = it->second;
+            }
+            for (unsigned int t=0; t<shard._treeStorage.size(); t++) {
+                remapFeatures(shard._treeStorage[t], featureIndex);
+                trees.push_back(shard._treeStorage[t]);
+            }
+            labelValues.insert(labelValues.end(), shard._labelValues.begin(), shard._labelValues.end());
+        }
+        
+        //add trees, keep label values sorted and unique
+        _treeStorage.insert(_treeStorage.end(), trees.begin(), trees.end());
+        if (_treeStorage.size() > 0) _root = _treeStorage.back();
+        labelValues.sort();
+        labelValues.unique();
+        _labelValues = labelValues;
+        
+        //if set, store head node splits of merged trees
+        if (_storeHeadNodeSplits) {
+            for (unsigned int t=0; t<trees.size(); t++) {
+                if (trees[t] != NULL && !trees[t]->isLeaf) {
+                    _headNodeSplitStore[_features[trees[t]->spltRule.first]][trees[t]->spltRule.second]++;
+                }
+            }
+        }
+        return true;
+    }
+    
+    //changes split feature indices of tree from another model's to this forest's
+    void RandomForest::remapFeatures(Node* n, vector<int>& featureIndex)
+    {
+        if (n == NULL || n->isLeaf) return;
+        n->spltRule.first = featureIndex[n->spltRule.first];
+        remapFeatures(n->chld[0], featureIndex);
+        remapFeatures(n->chld[1], featureIndex);
     }
     
     //stores the split and threshold for the head node
@@ -83,55 +352,126 @@ namespace trees
         return _headNodeSplitStore;
     }
     
-    //returns bootstrap sample from original training set
-    void RandomForest::getBootstrapSample(Matrix& trainData, vector<int>& trainLabels, Matrix& sample, vector<int>& sampLabels)
+    //returns root of each tree in the forest
+    vector<const DecisionTree::Node*> RandomForest::getTrees() const
     {
-        //randomly pick n random indices (n=trainData.size())
-        int n = trainData.size();
-        
-        //initialize random number generator
-        srand (time(NULL));
+        return vector<const Node*>(_treeStorage.begin(), _treeStorage.end());
+    }
+    
+    //prunes each tree of the forest for cost-complexity penalty alpha,
+    //  returns total # of leaves left
+    int RandomForest::pruneTree(Matrix& data, vector<int>& labels, double alpha)
+    {
+        vector<int> samples(data.size());
+        for (unsigned int i=0; i<data.size(); i++) {
+            samples[i] = i;
+        }
+        DataView view(data);
         
-        //randomly choose n indices and put in sample matrix
-        for (unsigned int i=0; i<n; i++) {
-            int randNum = rand() % n;
-            sample.push_back(trainData[randNum]);
-            sampLabels.push_back(trainLabels[randNum]);
+        int nLeaves = 0;
+        for (unsigned int i=0; i<_treeStorage.size(); i++) {
+            nLeaves += pruneRoot(_treeStorage[i], view, labels.empty() ? NULL : &labels[0], samples, alpha);
         }
+        return nLeaves;
     }
     
-    //makes prediction with each model, takes mode of predictions
-    void RandomForest::makePredictions(Matrix& testData, vector<int>& predictions)
+    //saves all trees of the forest to text file
+    bool RandomForest::saveModel(const string& fileName) const
     {
-        vector< vector<int> > predictionStore;
-        
-        //iterate through each tree and make predictions
+        ofstream out(fileName.c_str());
+        if (!out) {
+            cerr << "Error: can't open " << fileName << " for writing" << endl;
+            return false;
+        }
+        writeModelHeader(out, _treeStorage.size());
         for (unsigned int i=0; i<_treeStorage.size(); i++) {
-            
-            _root = _treeStorage[i];
-            
-            vector<int> p = vector<int>(testData.size(), 0);
-            DecisionTree::makePredictions(testData, p);
-            
-            predictionStore.push_back(p);
-            p.clear();
+            writeTree(out, _treeStorage[i]);
+        }
+        return out.good();
+    }
+    
+    //loads forest (or single tree) saved with saveModel, replacing current trees;
+    //  a forest saved without trees (e.g. an empty shard) loads as an empty forest
+    bool RandomForest::loadModel(const string& fileName)
+    {
+        ifstream in(fileName.c_str());
+        if (!in) {
+            cerr << "Error: can't open " << fileName << endl;
+            return false;
+        }
+        int nTrees = readModelHeader(in);
+        if (nTrees < 0) {
+            cerr << "Error: " << fileName << " is not a libtrees model" << endl;
+            return false;
+        }
+        
+        vector<Node*> trees;
+        bool ok = true;
+        for (int i=0; i<nTrees && ok; i++) {
+            trees.push_back(readTree(in, ok));
+        }
+        if (!ok) {
+            cerr << "Error: corrupt tree in " << fileName << endl;
+            for (unsigned int i=0; i<trees.size(); i++) {
+                deleteTree(trees[i]);
+            }
+            return false;
         }
         
+        for (unsigned int i=0; i<trees.size(); i++) {
+            int id = 0;
+            numberNodes(trees[i], id);
+        }
+        _treeStorage = trees;
+        _nBootSamps = nTrees;
+        _root = _treeStorage.empty() ? NULL : _treeStorage.back();
+        return true;
+    }
+    
+    //returns bootstrap sample (row indices) from original training set of n samples
+    void RandomForest::getBootstrapSample(int n, vector<int>& sample)
+    {
+        //randomly choose n indices
+        sample.resize(n);
+        for (int i=0; i<n; i++) {
+            sample[i] = randomInt(n);
+        }
+    }
+    
+    //makes prediction with each model, takes mode of predictions; const and
+    //  safe to call from many threads at once (only per-call scratch is written)
+    void RandomForest::predict(const DataView& testData, int* predictions) const
+    {
+        if (_treeStorage.size() == 0) {
+            cerr << "Error: random forest has not been trained" << endl;
+            return;
+        }
+        long stride = testData.colStride();
+        
+        //votes for each label (by position in _labelValues) for current sample,
+        //  allocated once per call
+        vector<int> labelVals(_labelValues.begin(), _labelValues.end());
+        vector<int> votes(labelVals.size());
+        
         //iterate through each sample
-        for (int j=0; j<predictionStore[0].size(); j++) {
-            
-            vector<int> results;
+        for (int j=0; j<testData.rows(); j++) {
+            const int* sample = testData.row(j);
+            fill(votes.begin(), votes.end(), 0);
             
-            //iterate through results from each tree
-            for (unsigned int i=0; i<predictionStore.size(); i++) {
-                
-                results.push_back(predictionStore[i][j]);
+            //iterate through each tree and count its prediction (labels
+            //  outside _labelValues get no vote, as in getLabelMode)
+            for (unsigned int i=0; i<_treeStorage.size(); i++) {
+                int lab = predictSample(_treeStorage[i], sample, stride);
+                vector<int>::iterator it = lower_bound(labelVals.begin(), labelVals.end(), lab);
+                if (it != labelVals.end() && *it == lab) votes[it - labelVals.begin()]++;
             }
             
-            //get mode of labels for prediction
-            predictions[j] = DecisionTree::getLabelMode(results);
-            results.clear();
+            //mode of votes for prediction (smallest label on ties, 0 if no votes)
+            int best = -1;
+            for (unsigned int l=0; l<votes.size(); l++) {
+                if (votes[l] > 0 && (best < 0 || votes[l] > votes[best])) best = l;
+            }
+            predictions[j] = (best < 0) ? 0 : labelVals[best];
         }
-        predictionStore.clear();
     }
 }
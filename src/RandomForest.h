@@ -24,9 +24,20 @@ namespace trees {
         //functions
         RandomForest(std::vector<std::string>&);
         void trainRandomForest(Matrix&, std::vector<int>&, int=100, int=10, int=20);
-        void makePredictions(Matrix&, std::vector<int>&);
+        void trainRandomForest(const DataView&, const int*, int=100, int=10, int=20);
+        bool trainRandomForestParallel(Matrix&, std::vector<int>&, int, const std::string&, int=100, int=10, int=20);
+        bool trainRandomForestParallel(const DataView&, const int*, int, const std::string&, int=100, int=10, int=20);
+        bool setShard(int, int);
+        void setExtraTrees(bool, bool=false);
+        bool mergeModels(const std::vector<std::string>&);
+        using DecisionTree::predict;
+        void predict(const DataView&, int*) const;
         void storeHeadNodeSplits();
         std::map<std::string, std::map<int, int> > getHeadNodeSplits();
+        std::vector<const Node*> getTrees() const;
+        int pruneTree(Matrix&, std::vector<int>&, double);
+        bool saveModel(const std::string&) const;
+        bool loadModel(const std::string&);
         
         
     protected:
@@ -36,10 +47,15 @@ namespace trees {
         int _nBootSamps;                                                //number bootstrap samples (trees) to make
         bool _storeHeadNodeSplits;                                      //sets whether we save head node data
         std::map<std::string, std::map<int, int> > _headNodeSplitStore; //stores all head node splits
+        int _shardIndex;                                                //shard of trees to train
+        int _nShards;                                                   //# of shards trees are split into
+        bool _bootstrap;                                                //train each tree on a bootstrap sample
         
         //functions
-        void getBootstrapSample(Matrix&, std::vector<int>&, Matrix&, std::vector<int>&);
+        void getBootstrapSample(int, std::vector<int>&);
         void storeHeadNodeData();
+        unsigned int treeSeed(unsigned int, int);
+        void remapFeatures(Node*, std::vector<int>&);
         
     };
 }
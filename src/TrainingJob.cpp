@@ -0,0 +1,212 @@
+/*
+ *  TrainingJob.cpp
+ *
+ *  Training Job: trains a random forest (or cross-validates a decision tree)
+ *      on a background thread.
+ *
+ *  Progress and cancellation go through the model (getProgress and
+ *      cancelTraining are safe to call while it trains), so the job only
+ *      owns the thread and its arguments.  Training checks for cancellation
+ *      (and its time/memory budgets) at every node, so a job stops shortly
+ *      after cancel() even in the middle of a large tree.
+ */
+
+
+#include "TrainingJob.h"
+
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+using namespace std;
+
+
+namespace trees
+{
+    TrainingJob::TrainingJob()
+    : _data(NULL, 0, 0, 0, 0)
+    {
+        _type = FOREST;
+        _model = NULL;
+        _forest = NULL;
+        _labels = NULL;
+        _started = false;
+        _done = false;
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_doneCond, NULL);
+    }
+
+    TrainingJob::~TrainingJob()
+    {
+        if (_started) {
+            if (isRunning()) cancel();
+            wait();
+        }
+        pthread_cond_destroy(&_doneCond);
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    //starts training forest on data in the background (same arguments as
+    //  RandomForest::trainRandomForest); false if a job is already running
+    bool TrainingJob::startForest(RandomForest& forest, const DecisionTree::DataView& data, const int* labels,
+                                  int nSamps, int nFeat, int minSize)
+    {
+        if (isRunning()) {
+            cerr << "Error: training job is already running" << endl;
+            return false;
+        }
+        _type = FOREST;
+        _forest = &forest;
+        _data = data;
+        _labels = labels;
+        _nSamps = nSamps;
+        _nFeat = nFeat;
+        _minSize = minSize;
+        return launch(&forest);
+    }
+
+    //starts k-fold cross-validation of model in the background (same arguments
+    //  as DecisionTree::performCrossValidation); false if a job is already running
+    bool TrainingJob::startCrossValidation(DecisionTree& model, const DecisionTree::DataView& data, const int* labels,
+                                           vector<int>& paramVals, int param, int k)
+    {
+        if (isRunning()) {
+            cerr << "Error: training job is already running" << endl;
+            return false;
+        }
+        _type = CROSS_VALIDATION;
+        _forest = NULL;
+        _data = data;
+        _labels = labels;
+        _paramVals = paramVals;
+        _param = param;
+        _k = k;
+        _cvResult.clear();
+        return launch(&model);
+    }
+
+    //starts thread running the job for model
+    bool TrainingJob::launch(DecisionTree* model)
+    {
+        //collect thread of a previous, finished job
+        if (_started) {
+            pthread_join(_thread, NULL);
+            _started = false;
+        }
+        _model = model;
+        _done = false;
+
+        //cancel() applies from here on, even before the thread begins training
+        _model->reserveTraining(true);
+
+        int err = pthread_create(&_thread, NULL, &TrainingJob::run, this);
+        if (err != 0) {
+            cerr << "Error: can't start training thread: " << strerror(err) << endl;
+            _model->reserveTraining(false);
+            _done = true;
+            return false;
+        }
+        _started = true;
+        return true;
+    }
+
+    //thread: runs the job, then marks it done
+    void* TrainingJob::run(void* arg)
+    {
+        TrainingJob* job = (TrainingJob*) arg;
+
+        //a cancel made before training began stops the run at its first check
+        if (job->_type == FOREST) {
+            job->_forest->trainRandomForest(job->_data, job->_labels, job->_nSamps, job->_nFeat, job->_minSize);
+        } else {
+            map<int, double> result = job->_model->performCrossValidation(job->_data, job->_labels, job->_paramVals,
+                                                                          job->_param, job->_k);
+            job->_cvResult.swap(result);
+        }
+
+        //release model in case the run returned before beginning to train
+        job->_model->reserveTraining(false);
+
+        pthread_mutex_lock(&job->_mutex);
+        job->_done = true;
+        pthread_cond_broadcast(&job->_doneCond);
+        pthread_mutex_unlock(&job->_mutex);
+        return NULL;
+    }
+
+    //asks job to stop (a forest keeps the trees finished so far)
+    void TrainingJob::cancel()
+    {
+        if (isRunning()) _model->cancelTraining();
+    }
+
+    //waits for job to finish, at most timeout seconds (-1 waits until it's
+    //  done); returns true if the job is finished
+    bool TrainingJob::wait(double timeout)
+    {
+        if (!_started) return _done;
+
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        if (timeout > 0) {
+            long ns = deadline.tv_nsec + (long)((timeout - (long)timeout)*1e9);
+            deadline.tv_sec += (long)timeout + ns/1000000000;
+            deadline.tv_nsec = ns % 1000000000;
+        }
+
+        pthread_mutex_lock(&_mutex);
+        while (!_done) {
+            if (timeout < 0) {
+                pthread_cond_wait(&_doneCond, &_mutex);
+            } else if (pthread_cond_timedwait(&_doneCond, &_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        bool done = _done;
+        pthread_mutex_unlock(&_mutex);
+
+        if (done) {
+            pthread_join(_thread, NULL);
+            _started = false;
+        }
+        return done;
+    }
+
+    //returns true while the job is training
+    bool TrainingJob::isRunning()
+    {
+        if (!_started) return false;
+        pthread_mutex_lock(&_mutex);
+        bool done = _done;
+        pthread_mutex_unlock(&_mutex);
+        return !done;
+    }
+
+    //returns progress of job (trees or folds done, nodes built, time elapsed and left)
+    DecisionTree::TrainingProgress TrainingJob::getProgress() const
+    {
+        if (_model != NULL) return _model->getProgress();
+
+        DecisionTree::TrainingProgress p;
+        p.running = false;
+        p.treesDone = 0;
+        p.treesTotal = 0;
+        p.nodesBuilt = 0;
+        p.memoryUsed = 0;
+        p.elapsed = 0.0;
+        p.eta = -1.0;
+        p.stopReason = DecisionTree::COMPLETED;
+        return p;
+    }
+
+    //returns accuracy per parameter value of a finished cross-validation job
+    //  (if stopped early, only the values reached; see performCrossValidation)
+    map<int, double> TrainingJob::getCrossValidationResult()
+    {
+        if (isRunning()) {
+            cerr << "Error: training job is still running" << endl;
+            return map<int, double>();
+        }
+        return _cvResult;
+    }
+}
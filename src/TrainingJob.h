@@ -0,0 +1,79 @@
+/*
+ *  TrainingJob.h
+ *
+ *  Training Job: trains a random forest (or cross-validates a decision tree)
+ *      on a background thread.  The job is a handle for watching progress
+ *      (trees done, nodes built, ETA), cancelling and waiting for the result;
+ *      a cancelled forest keeps the trees finished so far.
+ *
+ *  The data and labels passed to a job must stay valid until it finishes,
+ *      and the model shouldn't be used (other than through the job) until then.
+ */
+
+#ifndef TrainingJob_H
+#define TrainingJob_H
+
+#include <pthread.h>
+
+#include "RandomForest.h"
+
+
+namespace trees {
+
+    class TrainingJob
+    {
+
+    public:
+
+        //constructor/destructor (destructor cancels and waits for a running job)
+        TrainingJob();
+        virtual ~TrainingJob();
+
+        //functions
+        bool startForest(RandomForest&, const DecisionTree::DataView&, const int*, int=100, int=10, int=20);
+        bool startCrossValidation(DecisionTree&, const DecisionTree::DataView&, const int*, std::vector<int>&, int=1, int=10);
+        void cancel();
+        bool wait(double=-1.0);
+        bool isRunning();
+        DecisionTree::TrainingProgress getProgress() const;
+        std::map<int, double> getCrossValidationResult();
+
+
+    protected:
+
+        //what the job runs
+        enum JobType { FOREST, CROSS_VALIDATION };
+
+        //global variables
+        JobType _type;                          //forest training or cross-validation
+        DecisionTree* _model;                   //model being trained
+        RandomForest* _forest;                  //same model, for forest jobs
+        DecisionTree::DataView _data;           //training data (not owned)
+        const int* _labels;                     //training labels (not owned)
+        int _nSamps;                            //# of trees (forest)
+        int _nFeat;                             //# of features per node (forest)
+        int _minSize;                           //min node size (forest)
+        std::vector<int> _paramVals;            //parameter values (cross-validation)
+        int _param;                             //parameter to validate (cross-validation)
+        int _k;                                 //# of folds (cross-validation)
+        std::map<int, double> _cvResult;        //accuracy per parameter value (cross-validation)
+        pthread_t _thread;                      //thread running the job
+        bool _started;                          //true if _thread has to be joined
+        bool _done;                             //set by thread when job is finished
+        pthread_mutex_t _mutex;                 //guards _done
+        pthread_cond_t _doneCond;               //signals _done
+
+        //functions
+        bool launch(DecisionTree*);
+        static void* run(void*);
+
+
+    private:
+
+        //not copyable (owns a pthread mutex)
+        TrainingJob(const TrainingJob&);
+        TrainingJob& operator=(const TrainingJob&);
+    };
+}
+
+#endif